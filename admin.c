@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "gameplay.h"
+#include "admin.h"
+#include "limit.h"
+#include "router.h"
+#include "client.h"
+#include "trace.h"
+#include "mem.h"
+
+/* Commands typed on the server's standard input, for whoever runs it.
+ * Replies go to standard output along with the rest of the server log.
+ */
+
+static char line[MAX_BUF];
+static int line_len = 0;
+
+static void admin_command(char *cmd) {
+    if (strcmp(cmd, "limits") == 0) {
+        limit_report();
+    } else if (strcmp(cmd, "conns") == 0) {
+        client_report();
+    } else if (strcmp(cmd, "mem") == 0) {
+        mem_report();
+    } else if (strcmp(cmd, "trace") == 0) {
+        if (router_trace()) {
+            // Passed on to the backends
+        } else if (trace_on) {
+            trace_request_dump();
+        } else {
+            printf("Tracing is off, start the server with -T to turn it on\n");
+        }
+    } else if (strcmp(cmd, "backends") == 0) {
+        router_report();
+    } else if (strcmp(cmd, "help") == 0) {
+        printf("Admin commands:\n"
+               "  limits    rate limiter settings and counters\n"
+               "  conns     memory used by connections\n"
+               "  mem       memory by category, with allocation rates\n"
+               "  trace     write the latest event timings to a file\n"
+               "  backends  clients on each backend, in router mode\n");
+    } else if (cmd[0] != '\0') {
+        printf("Unknown admin command '%s', try help\n", cmd);
+    }
+    fflush(stdout);
+}
+
+/* Take len bytes typed on standard input and run every complete line.
+ */
+void admin_input(const char *data, int len) {
+    for (int i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            line[line_len] = '\0';
+            if (line_len > 0 && line[line_len - 1] == '\r') {
+                line[line_len - 1] = '\0';
+            }
+            admin_command(line);
+            line_len = 0;
+        } else if (line_len < MAX_BUF - 1) {
+            line[line_len++] = data[i];
+        }
+    }
+}
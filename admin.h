@@ -0,0 +1,6 @@
+#ifndef _ADMIN_H_
+#define _ADMIN_H_
+
+void admin_input(const char *data, int len);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "client.h"
+#include "pool.h"
+#include "mem.h"
+#include "netio.h"
+#include "limit.h"
+
+/* Connection records. An idle client, whether at the name prompt, waiting
+ * for their turn or watching, costs one small record from the pool plus
+ * their name, on top of the entries the rate limiter and the output code
+ * keep for every descriptor (see client_report). Input is read into one
+ * line buffer shared by every client and only moves into a block of its
+ * own when a client sent part of a line and the rest has not arrived yet,
+ * so memory grows with the traffic and not with the number of
+ * connections.
+ */
+
+static char line_buf[MAX_BUF];
+static struct client *line_owner = NULL;  // Whose input is in line_buf
+static char no_name[] = "";
+
+// For client_report
+static long num_clients = 0;
+static long num_names = 0;
+static long name_bytes = 0;
+static long num_inputs = 0;
+static long input_bytes = 0;
+
+// Allocate a record for a new connection on fd from addr
+struct client *client_new(int fd, struct in_addr addr) {
+    struct client *p = pool_alloc(MEM_CLIENTS, sizeof(struct client));
+    p->fd = fd;
+    p->ipaddr = addr;
+    p->next = NULL;
+    p->name = no_name;
+    p->inbuf = NULL;
+    p->in_len = 0;
+    num_clients++;
+    return p;
+}
+
+// Release p and everything it holds
+void client_free(struct client *p) {
+    client_set_name(p, "");
+    client_clear_input(p);
+    pool_free(MEM_CLIENTS, p, sizeof(struct client));
+    num_clients--;
+}
+
+void client_set_name(struct client *p, const char *name) {
+    if (p->name != no_name) {
+        int size = strlen(p->name) + 1;
+        num_names--;
+        name_bytes -= pool_block_size(size);
+        pool_free(MEM_CLIENTS, p->name, size);
+        p->name = no_name;
+    }
+    if (name[0] != '\0') {
+        int size = strlen(name) + 1;
+        p->name = pool_alloc(MEM_CLIENTS, size);
+        memcpy(p->name, name, size);
+        num_names++;
+        name_bytes += pool_block_size(size);
+    }
+}
+
+/* Get p's input ready for a read: point p->inbuf at the shared line
+ * buffer, which has room for MAX_BUF bytes, holding the p->in_len bytes
+ * of any partial line p sent before. Returns p->inbuf.
+ */
+char *client_input(struct client *p) {
+    if (p->inbuf == line_buf) {
+        return line_buf;
+    }
+    // Whoever was read last still has a partial line in there
+    if (line_owner != NULL) {
+        client_keep_input(line_owner, MAX_BUF);
+    }
+    if (p->inbuf != NULL) {
+        memcpy(line_buf, p->inbuf, p->in_len);
+        num_inputs--;
+        input_bytes -= pool_block_size(p->in_len + 1);
+        pool_free(MEM_BUFFERS, p->inbuf, p->in_len + 1);
+    }
+    line_buf[p->in_len] = '\0';
+    p->inbuf = line_buf;
+    line_owner = p;
+    return line_buf;
+}
+
+/* After a read that left p with part of a line, move it out of the shared
+ * buffer into a block of its own. A line that has filled room bytes
+ * without ending can never be handled, so it is dropped.
+ */
+void client_keep_input(struct client *p, int room) {
+    if (p->inbuf != line_buf) {
+        return;
+    }
+    line_owner = NULL;
+    p->inbuf = NULL;
+    if (p->in_len == 0 || p->in_len >= room) {
+        p->in_len = 0;
+        return;
+    }
+    p->inbuf = pool_alloc(MEM_BUFFERS, p->in_len + 1);
+    memcpy(p->inbuf, line_buf, p->in_len);
+    p->inbuf[p->in_len] = '\0';
+    num_inputs++;
+    input_bytes += pool_block_size(p->in_len + 1);
+}
+
+// Give p the partial line in data, e.g. one handed over by an upgrade
+void client_set_input(struct client *p, const char *data, int len) {
+    client_clear_input(p);
+    if (len <= 0 || len >= MAX_BUF) {
+        return;
+    }
+    client_input(p);
+    memcpy(p->inbuf, data, len);
+    p->in_len = len;
+    client_keep_input(p, MAX_BUF);
+}
+
+// Forget p's input, once a whole line has been handled
+void client_clear_input(struct client *p) {
+    if (p->inbuf == line_buf) {
+        line_owner = NULL;
+    } else if (p->inbuf != NULL) {
+        num_inputs--;
+        input_bytes -= pool_block_size(p->in_len + 1);
+        pool_free(MEM_BUFFERS, p->inbuf, p->in_len + 1);
+    }
+    p->inbuf = NULL;
+    p->in_len = 0;
+}
+
+// Print how much memory connections take
+void client_report(void) {
+    int record = pool_block_size(sizeof(struct client));
+    printf("Connections: %ld, %d bytes per record\n", num_clients, record);
+    printf("  names: %ld, %ld bytes\n", num_names, name_bytes);
+    printf("  partial lines: %ld, %ld bytes\n", num_inputs, input_bytes);
+    // The rate limiter and the output code keep a table entry per descriptor
+    int limit_bytes = limit_fd_bytes();
+    int net_bytes = net_fd_bytes();
+    printf("  per descriptor tables: %d bytes (rate limit %d, output and reads %d)\n",
+           limit_bytes + net_bytes, limit_bytes, net_bytes);
+    if (num_clients > 0) {
+        printf("  bytes per idle connection: %ld\n",
+               (num_clients * record + name_bytes) / num_clients + limit_bytes + net_bytes);
+    }
+    pool_report();
+}
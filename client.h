@@ -0,0 +1,15 @@
+#ifndef _CLIENT_H_
+#define _CLIENT_H_
+
+#include "gameplay.h"
+
+struct client *client_new(int fd, struct in_addr addr);
+void client_free(struct client *p);
+void client_set_name(struct client *p, const char *name);
+char *client_input(struct client *p);
+void client_keep_input(struct client *p, int room);
+void client_set_input(struct client *p, const char *data, int len);
+void client_clear_input(struct client *p);
+void client_report(void);
+
+#endif
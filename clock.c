@@ -0,0 +1,20 @@
+#include <time.h>
+
+#include "clock.h"
+
+// Nanoseconds on a clock that never jumps
+long clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// Milliseconds on the same clock
+long clock_ms(void) {
+    return clock_ns() / 1000000;
+}
+
+// Seconds on the same clock
+double clock_seconds(void) {
+    return clock_ns() / 1e9;
+}
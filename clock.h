@@ -0,0 +1,9 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+// Time on CLOCK_MONOTONIC, which never jumps, in the unit each caller wants
+long clock_ns(void);
+long clock_ms(void);
+double clock_seconds(void);
+
+#endif
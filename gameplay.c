@@ -4,11 +4,13 @@
 #include <string.h>
 
 #include "gameplay.h"
+#include "trace.h"
 
 /* Return a status message that shows the current state of the game.
  * Assumes that the caller has allocated MAX_MSG bytes for msg.
  */
 char *status_message(char *msg, struct game_state *game) {
+    long traced = TRACE_START();
     sprintf(msg, "***************\r\n"
            "Word to guess: %s\r\nGuesses remaining: %d\r\n"
            "Letters guessed: \r\n", game->guess, game->guesses_left);
@@ -21,6 +23,7 @@ char *status_message(char *msg, struct game_state *game) {
         }
     }
     strncat(msg, "\r\n***************\r\n", MAX_MSG);
+    TRACE_STOP(TRACE_STATUS, traced);
     return msg;
 }
 
@@ -1,5 +1,11 @@
+#ifndef _GAMEPLAY_H_
+#define _GAMEPLAY_H_
+
+#include <stdio.h>
 #include <netinet/in.h>
 
+#include "wordset.h"
+
 #define MAX_NAME 30  
 #define MAX_MSG 128
 #define MAX_WORD 20
@@ -7,20 +13,24 @@
 #define MAX_GUESSES 4
 #define NUM_LETTERS 26
 #define WELCOME_MSG "Welcome to our word game. What is your name? "
+#define SPECTATE_CMD "/watch"     // Entered as a name to watch instead of play
+#define SPECTATE_INTERVAL_MS 500  // Spectators get at most one update this often
 
+// Kept small, since there is one per connection (see client.c)
 struct client {
     int fd;
     struct in_addr ipaddr;
     struct client *next;
-    char name[MAX_NAME];
-    char inbuf[MAX_BUF];  // Used to hold input from the client
-    char *in_ptr;         // A pointer into inbuf to help with partial reads
+    char *name;           // "" until the client has entered one
+    char *inbuf;          // Input not handled yet, or NULL if there is none
+    unsigned short in_len;  // Bytes in inbuf, to help with partial reads
 };
 
 // Information about the dictionary used to pick random word
 struct dictionary {
     FILE *fp;
     int size;
+    struct word_set words;  // For checking full-word guesses
 };
 
 struct game_state {
@@ -33,9 +43,14 @@ struct game_state {
     
     struct client *head;
     struct client *current_player;  // Who is now guessing
+
+    struct client *spectators;      // Watching only, never part of the turn order
+    int changed;                    // Set when spectators have not seen the latest state
 };
 
 
 void init_game(struct game_state *game, char *dict_name);
 int get_file_length(char *filename);
-char *status_message(char *msg, struct game_state *game);
\ No newline at end of file
+char *status_message(char *msg, struct game_state *game);
+
+#endif
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "limit.h"
+#include "mem.h"
+
+/* A token bucket per connection, indexed by descriptor. Every read from a
+ * client costs one token and tokens come back at the configured rate, up
+ * to the burst size. A client that runs out is paused: the server stops
+ * reading from its socket, so its input waits in the kernel and TCP slows
+ * the sender down, until the next token is due. A client that keeps
+ * getting paused is disconnected. Clients that let their bucket fill up
+ * again are forgiven.
+ */
+
+struct bucket {
+    double tokens;
+    long last;          // When tokens was last topped up, in ms
+    int strikes;        // Pauses since the bucket was last full
+    long resume_at;     // Paused until this time, or 0
+};
+
+// A paused descriptor waiting for its next token
+struct paused {
+    int fd;
+    long resume_at;
+};
+
+static double rate = LIMIT_RATE;
+static int burst = LIMIT_BURST;
+static int max_strikes = LIMIT_STRIKES;
+
+static struct bucket *buckets = NULL;
+static int num_buckets = 0;
+static struct paused *paused = NULL;
+static int num_paused = 0;
+static int paused_cap = 0;
+
+// Counters for limit_report
+static long reads_allowed = 0;
+static long throttles = 0;
+static long kicks = 0;
+
+/* Set the limits for all clients. A rate of 0 turns limiting off and a
+ * strikes value of 0 never disconnects anyone.
+ */
+void limit_configure(double new_rate, int new_burst, int new_strikes) {
+    rate = new_rate;
+    burst = new_burst > 0 ? new_burst : 1;
+    max_strikes = new_strikes;
+}
+
+static struct bucket *get_bucket(int fd) {
+    if (fd >= num_buckets) {
+        int n = num_buckets ? num_buckets : 64;
+        while (n <= fd) {
+            n *= 2;
+        }
+        buckets = mem_realloc(MEM_CLIENTS, buckets, sizeof(struct bucket) * num_buckets,
+                              sizeof(struct bucket) * n);
+        // A zero last time marks a bucket that has to be filled first
+        memset(buckets + num_buckets, 0, sizeof(struct bucket) * (n - num_buckets));
+        num_buckets = n;
+    }
+    return &buckets[fd];
+}
+
+/* Give a newly connected fd a full bucket.
+ */
+void limit_reset(int fd) {
+    struct bucket *b = get_bucket(fd);
+    memset(b, 0, sizeof(*b));
+}
+
+/* Charge one read on fd at time now (in ms). Returns LIMIT_OK, LIMIT_PAUSE
+ * or LIMIT_KICK.
+ */
+int limit_take(int fd, long now) {
+    if (rate <= 0) {
+        return LIMIT_OK;
+    }
+    struct bucket *b = get_bucket(fd);
+    if (b->last == 0) {
+        b->tokens = burst;
+    } else {
+        b->tokens += (now - b->last) * rate / 1000.0;
+        if (b->tokens >= burst) {
+            b->tokens = burst;
+            b->strikes = 0;
+        }
+    }
+    b->last = now;
+    b->resume_at = 0;
+
+    if (b->tokens >= 1) {
+        b->tokens -= 1;
+        reads_allowed++;
+        // The read that empties the bucket is allowed, the next one waits
+        if (b->tokens >= 1) {
+            return LIMIT_OK;
+        }
+    }
+
+    b->strikes++;
+    if (max_strikes > 0 && b->strikes > max_strikes) {
+        kicks++;
+        return LIMIT_KICK;
+    }
+    throttles++;
+    b->resume_at = now + (long)((1 - b->tokens) * 1000 / rate) + 1;
+    if (num_paused == paused_cap) {
+        int cap = paused_cap ? paused_cap * 2 : 16;
+        paused = mem_realloc(MEM_CLIENTS, paused, sizeof(struct paused) * paused_cap,
+                             sizeof(struct paused) * cap);
+        paused_cap = cap;
+    }
+    paused[num_paused].fd = fd;
+    paused[num_paused].resume_at = b->resume_at;
+    num_paused++;
+    return LIMIT_PAUSE;
+}
+
+/* Return the number of ms until the next paused client may be read
+ * again, or -1 if none is paused.
+ */
+int limit_next_resume(long now) {
+    int wait = -1;
+    for (int i = 0; i < num_paused; i++) {
+        long left = paused[i].resume_at - now;
+        if (left < 0) {
+            left = 0;
+        }
+        if (wait < 0 || left < wait) {
+            wait = left;
+        }
+    }
+    return wait;
+}
+
+/* Put up to max_fds descriptors that may be read again into fds and return
+ * how many there are. They are no longer considered paused.
+ */
+int limit_resume(long now, int *fds, int max_fds) {
+    int n = 0;
+    int i = 0;
+    while (i < num_paused && n < max_fds) {
+        if (paused[i].resume_at <= now) {
+            fds[n++] = paused[i].fd;
+            paused[i] = paused[--num_paused];
+        } else {
+            i++;
+        }
+    }
+    return n;
+}
+
+// Bytes the limiter keeps for every descriptor, connected or not
+int limit_fd_bytes(void) {
+    return sizeof(struct bucket);
+}
+
+// Print the limiter counters
+void limit_report(void) {
+    if (rate <= 0) {
+        printf("Rate limiting is off\n");
+        return;
+    }
+    printf("Rate limit: %.1f reads/s, burst %d, disconnect after %d throttles\n",
+           rate, burst, max_strikes);
+    printf("  reads allowed: %ld\n  throttled: %ld\n  disconnected: %ld\n  paused now: %d\n",
+           reads_allowed, throttles, kicks, num_paused);
+}
@@ -0,0 +1,21 @@
+#ifndef _LIMIT_H_
+#define _LIMIT_H_
+
+#define LIMIT_RATE 5.0     // Default reads per second allowed from one client
+#define LIMIT_BURST 10     // Default reads allowed at once before throttling
+#define LIMIT_STRIKES 5    // Default throttles before a client is disconnected
+
+// What to do with a read from a client
+#define LIMIT_OK 0         // Go ahead
+#define LIMIT_PAUSE 1      // Out of tokens: stop reading until limit_resume says so
+#define LIMIT_KICK 2       // Throttled too often: disconnect
+
+void limit_configure(double rate, int burst, int strikes);
+void limit_reset(int fd);
+int limit_take(int fd, long now);
+int limit_next_resume(long now);
+int limit_resume(long now, int *fds, int max_fds);
+int limit_fd_bytes(void);
+void limit_report(void);
+
+#endif
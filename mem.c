@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mem.h"
+#include "pool.h"
+#include "clock.h"
+
+/* Memory accounting. Everything the server keeps beyond one loop iteration
+ * is allocated through here or through the pool under one of a few
+ * categories, so the admin command "mem" can tell where memory goes and
+ * how fast it is churned. Like pool_free, mem_free is told the size by its
+ * caller, which saves a header in front of every block. The statistics
+ * writer thread frees memory too, so the counters are updated atomically.
+ */
+
+struct mem_category {
+    long live;          // Bytes allocated right now
+    long peak;
+    long allocs;        // Allocations ever made
+    long alloc_bytes;   // Bytes those asked for
+    long last_allocs;   // allocs and alloc_bytes at the last report
+    long last_bytes;
+};
+
+static struct mem_category categories[MEM_CATEGORIES];
+static const char *category_names[MEM_CATEGORIES] = {
+    "clients", "messages", "dictionary", "buffers", "statistics"
+};
+static long started = 0;       // ms when the first allocation was noted
+static long last_report = 0;   // ms when mem_report last ran
+
+// Count size bytes allocated elsewhere, e.g. by the pool, under category
+void mem_note_alloc(int category, long size) {
+    struct mem_category *mc = &categories[category];
+    if (__atomic_load_n(&started, __ATOMIC_RELAXED) == 0) {
+        // Any thread may get here first; the earliest one to store wins
+        long zero = 0;
+        __atomic_compare_exchange_n(&started, &zero, clock_ms(), 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    long live = __atomic_add_fetch(&mc->live, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mc->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&mc->alloc_bytes, size, __ATOMIC_RELAXED);
+    long peak = __atomic_load_n(&mc->peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&mc->peak, &peak, live, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+void mem_note_free(int category, long size) {
+    __atomic_sub_fetch(&categories[category].live, size, __ATOMIC_RELAXED);
+}
+
+void *mem_alloc(int category, size_t size) {
+    void *ptr = malloc(size);
+    if (!ptr) {
+        perror("malloc");
+        exit(1);
+    }
+    mem_note_alloc(category, size);
+    return ptr;
+}
+
+// Resize a block that mem_alloc(category, old_size) returned, or allocate one if ptr is NULL
+void *mem_realloc(int category, void *ptr, size_t old_size, size_t new_size) {
+    ptr = realloc(ptr, new_size);
+    if (!ptr) {
+        perror("realloc");
+        exit(1);
+    }
+    mem_note_free(category, old_size);
+    mem_note_alloc(category, new_size);
+    return ptr;
+}
+
+// Give back a block that mem_alloc(category, size) returned
+void mem_free(int category, void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    free(ptr);
+    mem_note_free(category, size);
+}
+
+/* Print live and peak bytes for each category and how fast it has been
+ * allocating since the last report, or since the start for the first one.
+ */
+void mem_report(void) {
+    long now = clock_ms();
+    long since = last_report ? last_report : __atomic_load_n(&started, __ATOMIC_RELAXED);
+    double secs = since && now > since ? (now - since) / 1000.0 : 0;
+    long total_live = 0;
+
+    printf("Memory by category, rates over the last %.1f s:\n", secs);
+    printf("  %-10s %10s %10s %10s %10s %12s\n",
+           "category", "live", "peak", "allocs", "allocs/s", "bytes/s");
+    for (int i = 0; i < MEM_CATEGORIES; i++) {
+        struct mem_category *mc = &categories[i];
+        long live = __atomic_load_n(&mc->live, __ATOMIC_RELAXED);
+        long peak = __atomic_load_n(&mc->peak, __ATOMIC_RELAXED);
+        long allocs = __atomic_load_n(&mc->allocs, __ATOMIC_RELAXED);
+        long bytes = __atomic_load_n(&mc->alloc_bytes, __ATOMIC_RELAXED);
+        double alloc_rate = 0, byte_rate = 0;
+        if (secs > 0) {
+            alloc_rate = (allocs - mc->last_allocs) / secs;
+            byte_rate = (bytes - mc->last_bytes) / secs;
+        }
+        printf("  %-10s %10ld %10ld %10ld %10.1f %12.1f\n",
+               category_names[i], live, peak, allocs, alloc_rate, byte_rate);
+        mc->last_allocs = allocs;
+        mc->last_bytes = bytes;
+        total_live += live;
+    }
+    printf("  %-10s %10ld\n", "total", total_live);
+    printf("  pool chunks: %ld bytes reserved, %ld in blocks handed out\n",
+           pool_reserved(), pool_bytes());
+    last_report = now;
+}
@@ -0,0 +1,21 @@
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stddef.h>
+
+// What memory is for
+#define MEM_CLIENTS 0     // Connection records, names, rate limiter buckets
+#define MEM_MESSAGES 1    // Output waiting to be sent
+#define MEM_DICTIONARY 2  // Words loaded from the dictionary
+#define MEM_BUFFERS 3     // Partial input lines, per-fd tables, upgrade and replay data
+#define MEM_STATS 4       // Player statistics and their log queue
+#define MEM_CATEGORIES 5
+
+void *mem_alloc(int category, size_t size);
+void *mem_realloc(int category, void *ptr, size_t old_size, size_t new_size);
+void mem_free(int category, void *ptr, size_t size);
+void mem_note_alloc(int category, long size);
+void mem_note_free(int category, long size);
+void mem_report(void);
+
+#endif
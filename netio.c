@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "gameplay.h"
+#include "netio.h"
+#include "record.h"
+#include "uring.h"
+#include "pool.h"
+#include "mem.h"
+#include "trace.h"
+
+static int net_mode = NET_LIVE;
+
+// Replay and io_uring: data that has already been read for input_fd
+static int input_fd = -1;
+static const char *input_data = NULL;
+static int input_len = 0;
+static long bytes_out = 0;
+
+/* With select, everything written to a client during one loop iteration
+ * is gathered here, indexed by descriptor, and sent by net_flush with a
+ * single system call per client. A guess then costs each player one write
+ * and usually one TCP segment instead of one per message. The data comes
+ * from the pool and goes back once it is sent, so idle clients hold none.
+ */
+struct outbuf {
+    char *data;
+    int len;
+    int cap;
+    int dirty;          // In dirty_fds
+};
+
+static struct outbuf *outbufs = NULL;
+static int num_outbufs = 0;
+static int *dirty_fds = NULL;
+static int num_dirty = 0;
+
+static void release_output(struct outbuf *out);
+
+void net_set_mode(int mode) {
+    // Output queued so far, e.g. handed over by an upgrade, goes out through io_uring
+    if (mode == NET_URING && net_mode == NET_LIVE) {
+        for (int i = 0; i < num_dirty; i++) {
+            struct outbuf *out = &outbufs[dirty_fds[i]];
+            out->dirty = 0;
+            if (out->len > 0) {
+                uring_queue_send(dirty_fds[i], out->data, out->len);
+            }
+            release_output(out);
+        }
+        num_dirty = 0;
+    }
+    net_mode = mode;
+}
+
+int net_get_mode(void) {
+    return net_mode;
+}
+
+/* Read up to room bytes from fd into buf, like read(2). When recording,
+ * every result that is not an error is logged.
+ */
+int net_read(int fd, char *buf, int room) {
+    if (net_mode != NET_LIVE) {
+        if (fd != input_fd) {
+            return 0;
+        }
+        if (input_len < 0) {  // The read failed
+            errno = -input_len;
+            input_fd = -1;
+            return -1;
+        }
+        // Anything past room is left for the next call, as read(2) would
+        int n = input_len < room ? input_len : room;
+        memcpy(buf, input_data, n);
+        input_data += n;
+        input_len -= n;
+        if (input_len == 0) {
+            input_fd = -1;
+        }
+        if (net_mode == NET_URING) {
+            record_read(fd, buf, n);
+        }
+        return n;
+    }
+    int num_read = read(fd, buf, room);
+    if (num_read >= 0) {
+        record_read(fd, buf, num_read);
+    }
+    return num_read;
+}
+
+// Append len bytes to the output gathered for fd
+static void queue_output(int fd, const char *buf, int len) {
+    if (fd >= num_outbufs) {
+        int n = num_outbufs ? num_outbufs : 64;
+        while (n <= fd) {
+            n *= 2;
+        }
+        outbufs = mem_realloc(MEM_BUFFERS, outbufs, sizeof(struct outbuf) * num_outbufs,
+                              sizeof(struct outbuf) * n);
+        dirty_fds = mem_realloc(MEM_BUFFERS, dirty_fds, sizeof(int) * num_outbufs, sizeof(int) * n);
+        memset(outbufs + num_outbufs, 0, sizeof(struct outbuf) * (n - num_outbufs));
+        num_outbufs = n;
+    }
+    struct outbuf *out = &outbufs[fd];
+    if (out->len + len > out->cap) {
+        int cap = pool_block_size(out->len + len);
+        if (cap > POOL_MAX && cap < 2 * out->cap) {
+            cap = 2 * out->cap;
+        }
+        char *data = pool_alloc(MEM_MESSAGES, cap);
+        if (out->len > 0) {
+            memcpy(data, out->data, out->len);
+        }
+        pool_free(MEM_MESSAGES, out->data, out->cap);
+        out->data = data;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, buf, len);
+    out->len += len;
+    if (!out->dirty) {
+        out->dirty = 1;
+        dirty_fds[num_dirty++] = fd;
+    }
+}
+
+// Give the memory of an output buffer that has been sent back to the pool
+static void release_output(struct outbuf *out) {
+    pool_free(MEM_MESSAGES, out->data, out->cap);
+    out->data = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
+
+// Send all of buf, retrying short sends. Returns -1 on error.
+static int send_all(int fd, const char *buf, int len, int flags) {
+    while (len > 0) {
+        int n = send(fd, buf, len, flags | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Write len bytes of buf to fd. The bytes are only queued: they go out
+ * with net_flush, or with the io_uring submission at the end of the loop
+ * iteration, and a failure is reported from there.
+ */
+int net_write(int fd, const char *buf, int len) {
+    if (net_mode == NET_URING) {
+        // A failure shows up later as URING_EV_WRITE_ERROR
+        return uring_queue_send(fd, buf, len);
+    }
+    if (net_mode == NET_REPLAY) {
+        bytes_out += len;
+        return len;
+    }
+    queue_output(fd, buf, len);
+    return len;
+}
+
+/* Send everything queued by net_write since the last flush, one system
+ * call per client. Puts up to max_failed descriptors whose send failed
+ * into failed and returns how many there are; the caller should drop
+ * those clients and flush again, since that writes more.
+ */
+int net_flush(int *failed, int max_failed) {
+    int num_failed = 0;
+    int i;
+    if (num_dirty == 0) {
+        return 0;
+    }
+    TRACE_BEGIN(TRACE_FLUSH, num_dirty);
+    for (i = 0; i < num_dirty && num_failed < max_failed; i++) {
+        struct outbuf *out = &outbufs[dirty_fds[i]];
+        out->dirty = 0;
+        if (out->len == 0) {
+            continue;
+        }
+        if (send_all(dirty_fds[i], out->data, out->len, 0) < 0) {
+            record_write_error(dirty_fds[i]);
+            failed[num_failed++] = dirty_fds[i];
+        }
+        release_output(out);
+    }
+    // Anything left over waits for the next call
+    memmove(dirty_fds, dirty_fds + i, sizeof(int) * (num_dirty - i));
+    num_dirty -= i;
+    TRACE_END();
+    return num_failed;
+}
+
+/* Format a message and write it to fd, like dprintf(3).
+ */
+int net_printf(int fd, const char *format, ...) {
+    char buf[4 * MAX_MSG];
+    va_list ap;
+
+    va_start(ap, format);
+    int len = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    if (len < 0) {
+        return -1;
+    }
+    if (len >= sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    return net_write(fd, buf, len);
+}
+
+// Output written to fd that has not been sent yet; sets *len to its length
+const char *net_unsent(int fd, int *len) {
+    if (net_mode == NET_URING) {
+        return uring_unsent(fd, len);
+    }
+    if (net_mode == NET_LIVE && fd < num_outbufs) {
+        *len = outbufs[fd].len;
+        return outbufs[fd].data;
+    }
+    *len = 0;
+    return NULL;
+}
+
+/* Send without ever blocking. Returns -1 with errno EAGAIN if the socket
+ * has no room. Nothing is recorded here: a caller that gives up on the
+ * client records that with record_drop.
+ */
+int net_send_nowait(int fd, const char *buf, int len) {
+    if (net_mode == NET_URING && uring_backlog(fd) > URING_MAX_BACKLOG) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (net_mode != NET_LIVE) {
+        return net_write(fd, buf, len);
+    }
+    return send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+int net_set_nonblocking(int fd) {
+    if (net_mode == NET_REPLAY) {
+        return 0;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl");
+        return -1;
+    }
+    return 0;
+}
+
+int net_close(int fd) {
+    if (fd == input_fd) {
+        input_fd = -1;
+    }
+    if (net_mode == NET_URING) {
+        uring_forget(fd);
+    }
+    if (net_mode == NET_REPLAY) {
+        return 0;
+    }
+    if (fd < num_outbufs && outbufs[fd].len > 0) {
+        // Last words, such as why the client is disconnected, if they fit
+        send_all(fd, outbufs[fd].data, outbufs[fd].len, MSG_DONTWAIT);
+        release_output(&outbufs[fd]);
+    }
+    return close(fd);
+}
+
+/* Replay and io_uring: make net_read on fd return these len bytes, which
+ * were read earlier. A len of 0 means end of file and a negative len is
+ * -errno of a failed read.
+ */
+void net_set_input(int fd, const char *data, int len) {
+    input_fd = fd;
+    input_data = data;
+    input_len = len;
+}
+
+// Return 1 if data passed to net_set_input for fd has not all been read
+int net_input_left(int fd) {
+    return fd == input_fd && input_len > 0;
+}
+
+// Bytes the game wrote to clients during a replay
+long net_bytes_out(void) {
+    return bytes_out;
+}
+
+// Bytes kept for every descriptor, connected or not, in this mode
+int net_fd_bytes(void) {
+    int bytes = sizeof(struct outbuf) + sizeof(int);
+    if (net_mode == NET_URING) {
+        bytes += uring_fd_bytes();
+    }
+    return bytes;
+}
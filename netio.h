@@ -0,0 +1,27 @@
+#ifndef _NETIO_H_
+#define _NETIO_H_
+
+/* All client I/O in the game logic goes through these calls, so the same
+ * code can run against real sockets or against a recorded session.
+ */
+#define NET_LIVE 0      // Real sockets
+#define NET_REPLAY 1    // Input comes from a recording, output is discarded
+#define NET_URING 2     // Real sockets driven by io_uring (see uring.c)
+
+void net_set_mode(int mode);
+int net_get_mode(void);
+int net_read(int fd, char *buf, int room);
+int net_write(int fd, const char *buf, int len);
+int net_flush(int *failed, int max_failed);
+const char *net_unsent(int fd, int *len);
+int net_printf(int fd, const char *format, ...) __attribute__((format(printf, 2, 3)));
+int net_send_nowait(int fd, const char *buf, int len);
+int net_set_nonblocking(int fd);
+int net_close(int fd);
+
+void net_set_input(int fd, const char *data, int len);
+int net_input_left(int fd);
+long net_bytes_out(void);
+int net_fd_bytes(void);
+
+#endif
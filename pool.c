@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pool.h"
+#include "mem.h"
+
+/* Small blocks in a few fixed size classes, for the data every connection
+ * has: its record and name, a partial input line and queued output. Blocks
+ * are carved out of POOL_CHUNK sized chunks, so they carry no malloc
+ * header, and a freed block goes on a free list for its class to be used
+ * again. The caller passes the size it asked for when freeing, which saves
+ * storing it in every block. Blocks are counted under the category the
+ * caller gives, at the size they really take up.
+ */
+
+static const int class_sizes[] = {16, 24, 32, 40, 48, 64, 96, 128, 192, POOL_MAX};
+#define NUM_CLASSES (int)(sizeof(class_sizes) / sizeof(class_sizes[0]))
+
+struct pool_class {
+    void *free_list;    // Each free block starts with a pointer to the next
+    long in_use;
+    long num_free;
+    long chunks;
+};
+
+static struct pool_class classes[NUM_CLASSES];
+// Blocks too big for any class
+static long big_blocks = 0;
+static long big_bytes = 0;
+
+// Index of the smallest class that fits size, or -1 if none does
+static int class_of(int size) {
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        if (size <= class_sizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// How many bytes a block of size bytes really takes up
+int pool_block_size(int size) {
+    int c = class_of(size);
+    return c < 0 ? size : class_sizes[c];
+}
+
+void *pool_alloc(int category, int size) {
+    mem_note_alloc(category, pool_block_size(size));
+    int c = class_of(size);
+    if (c < 0) {
+        void *block = malloc(size);
+        if (!block) {
+            perror("malloc");
+            exit(1);
+        }
+        big_blocks++;
+        big_bytes += size;
+        return block;
+    }
+
+    struct pool_class *pc = &classes[c];
+    if (pc->free_list == NULL) {
+        char *chunk = malloc(POOL_CHUNK);
+        if (!chunk) {
+            perror("malloc");
+            exit(1);
+        }
+        pc->chunks++;
+        for (int off = 0; off + class_sizes[c] <= POOL_CHUNK; off += class_sizes[c]) {
+            void **block = (void **)(chunk + off);
+            *block = pc->free_list;
+            pc->free_list = block;
+            pc->num_free++;
+        }
+    }
+    void **block = pc->free_list;
+    pc->free_list = *block;
+    pc->num_free--;
+    pc->in_use++;
+    return block;
+}
+
+// Give back a block that pool_alloc(category, size) returned
+void pool_free(int category, void *block, int size) {
+    if (block == NULL) {
+        return;
+    }
+    mem_note_free(category, pool_block_size(size));
+    int c = class_of(size);
+    if (c < 0) {
+        big_blocks--;
+        big_bytes -= size;
+        free(block);
+        return;
+    }
+    struct pool_class *pc = &classes[c];
+    *(void **)block = pc->free_list;
+    pc->free_list = block;
+    pc->num_free++;
+    pc->in_use--;
+}
+
+// Bytes in blocks handed out right now
+long pool_bytes(void) {
+    long bytes = big_bytes;
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        bytes += classes[i].in_use * class_sizes[i];
+    }
+    return bytes;
+}
+
+// Bytes taken from malloc, whether handed out or on a free list
+long pool_reserved(void) {
+    long reserved = big_bytes;
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        reserved += classes[i].chunks * POOL_CHUNK;
+    }
+    return reserved;
+}
+
+// Print how every size class is used
+void pool_report(void) {
+    printf("Pool blocks in use / free:\n");
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        if (classes[i].chunks == 0) {
+            continue;
+        }
+        printf("  %4d bytes: %ld / %ld\n", class_sizes[i], classes[i].in_use, classes[i].num_free);
+    }
+    if (big_blocks > 0) {
+        printf("  larger: %ld blocks, %ld bytes\n", big_blocks, big_bytes);
+    }
+    printf("  %ld bytes in use, %ld reserved\n", pool_bytes(), pool_reserved());
+}
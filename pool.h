@@ -0,0 +1,14 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#define POOL_MAX 256     // Bigger blocks come straight from malloc
+#define POOL_CHUNK 4096  // Blocks of one size class are carved out of chunks this big
+
+void *pool_alloc(int category, int size);
+void pool_free(int category, void *block, int size);
+int pool_block_size(int size);
+long pool_bytes(void);
+long pool_reserved(void);
+void pool_report(void);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "record.h"
+#include "trace.h"
+#include "mem.h"
+
+/* A recording is a header followed by events, each a one byte type and
+ * then its fields in host byte order:
+ *   REC_SEED         seed (4 bytes)
+ *   REC_ACCEPT       fd (4 bytes), IPv4 address (4 bytes)
+ *   REC_READ         fd (4 bytes), length (2 bytes), the bytes read
+ *   REC_CLOSE        fd (4 bytes)
+ *   REC_WRITE_ERROR  fd (4 bytes)
+ *   REC_DROP         fd (4 bytes)
+ * It is only meant to be replayed on the machine that recorded it.
+ */
+
+#define REC_MAGIC "WSREC1\n"
+#define REC_BUFSIZE (64 * 1024)
+
+static FILE *rec_fp = NULL;
+
+/* Start recording to path, replacing any earlier recording.
+ */
+void record_open(char *path) {
+    rec_fp = fopen(path, "w");
+    if (rec_fp == NULL) {
+        perror("Opening recording");
+        exit(1);
+    }
+    // Events are small, so let stdio gather them into large writes
+    setvbuf(rec_fp, NULL, _IOFBF, REC_BUFSIZE);
+    fwrite(REC_MAGIC, 1, sizeof(REC_MAGIC), rec_fp);
+}
+
+void record_close(void) {
+    if (rec_fp != NULL) {
+        fclose(rec_fp);
+        rec_fp = NULL;
+    }
+}
+
+int recording(void) {
+    return rec_fp != NULL;
+}
+
+static void put_event(uint8_t type, int fd) {
+    int32_t fd32 = fd;
+    fputc(type, rec_fp);
+    fwrite(&fd32, sizeof(fd32), 1, rec_fp);
+}
+
+void record_seed(unsigned int seed) {
+    if (rec_fp == NULL) {
+        return;
+    }
+    uint32_t seed32 = seed;
+    fputc(REC_SEED, rec_fp);
+    fwrite(&seed32, sizeof(seed32), 1, rec_fp);
+}
+
+void record_accept(int fd, struct in_addr addr) {
+    if (rec_fp == NULL) {
+        return;
+    }
+    put_event(REC_ACCEPT, fd);
+    fwrite(&addr.s_addr, sizeof(addr.s_addr), 1, rec_fp);
+}
+
+/* Record the result of one read from fd. A len of 0 is a disconnect.
+ */
+void record_read(int fd, char *buf, int len) {
+    if (rec_fp == NULL) {
+        return;
+    }
+    if (len == 0) {
+        put_event(REC_CLOSE, fd);
+        return;
+    }
+    long traced = TRACE_START();
+    uint16_t len16 = len;
+    put_event(REC_READ, fd);
+    fwrite(&len16, sizeof(len16), 1, rec_fp);
+    fwrite(buf, 1, len, rec_fp);
+    TRACE_STOP(TRACE_LOG, traced);
+}
+
+void record_write_error(int fd) {
+    if (rec_fp == NULL) {
+        return;
+    }
+    put_event(REC_WRITE_ERROR, fd);
+}
+
+/* Record that the server itself disconnected fd, which replay has to do at
+ * the same point.
+ */
+void record_drop(int fd) {
+    if (rec_fp == NULL) {
+        return;
+    }
+    put_event(REC_DROP, fd);
+}
+
+// Copy size bytes at *pos into dest, or return -1 if the data runs out
+static int take(void *dest, char **pos, char *end, size_t size) {
+    if (end - *pos < (long)size) {
+        return -1;
+    }
+    memcpy(dest, *pos, size);
+    *pos += size;
+    return 0;
+}
+
+/* Load the recording at path into memory so it can be replayed without
+ * any file I/O. Returns an array of events and sets *num_events to its
+ * length. The data of REC_READ events points into memory that stays
+ * allocated for the life of the process.
+ */
+struct rec_event *replay_load(char *path, int *num_events) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror("Opening recording");
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    char *data = mem_alloc(MEM_BUFFERS, size);
+    if (fread(data, 1, size, fp) != size) {
+        perror("Reading recording");
+        exit(1);
+    }
+    fclose(fp);
+
+    if (size < sizeof(REC_MAGIC) || memcmp(data, REC_MAGIC, sizeof(REC_MAGIC)) != 0) {
+        fprintf(stderr, "%s is not a wordsrv recording\n", path);
+        exit(1);
+    }
+
+    int capacity = 1024;
+    int count = 0;
+    struct rec_event *events = mem_alloc(MEM_BUFFERS, sizeof(struct rec_event) * capacity);
+    char *pos = data + sizeof(REC_MAGIC);
+    char *end = data + size;
+    while (pos < end) {
+        if (count == capacity) {
+            events = mem_realloc(MEM_BUFFERS, events, sizeof(struct rec_event) * capacity,
+                                 sizeof(struct rec_event) * capacity * 2);
+            capacity *= 2;
+        }
+        struct rec_event *ev = &events[count];
+        memset(ev, 0, sizeof(*ev));
+        ev->type = (uint8_t)*pos++;
+
+        int32_t fd32 = -1;
+        uint32_t u32;
+        uint16_t len16;
+        int bad = 0;
+        if (ev->type == REC_SEED) {
+            bad = take(&u32, &pos, end, sizeof(u32));
+            ev->seed = u32;
+        } else if (ev->type >= REC_ACCEPT && ev->type <= REC_DROP) {
+            bad = take(&fd32, &pos, end, sizeof(fd32));
+            ev->fd = fd32;
+            if (!bad && ev->type == REC_ACCEPT) {
+                bad = take(&u32, &pos, end, sizeof(u32));
+                ev->addr.s_addr = u32;
+            } else if (!bad && ev->type == REC_READ) {
+                bad = take(&len16, &pos, end, sizeof(len16));
+                ev->len = len16;
+                ev->data = pos;
+                if (!bad && end - pos < ev->len) {
+                    bad = -1;
+                }
+                pos += ev->len;
+            }
+        } else {
+            fprintf(stderr, "Unknown event type %d in recording\n", ev->type);
+            exit(1);
+        }
+        if (bad) {
+            // The server was stopped in the middle of writing an event
+            fprintf(stderr, "Recording ends with an incomplete event, ignoring it\n");
+            break;
+        }
+        count++;
+    }
+    *num_events = count;
+    return events;
+}
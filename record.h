@@ -0,0 +1,34 @@
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include <netinet/in.h>
+
+// Kinds of events in a recording
+#define REC_SEED 1          // The value passed to srandom
+#define REC_ACCEPT 2        // A new connection
+#define REC_READ 3          // A chunk returned by read()
+#define REC_CLOSE 4         // read() returned 0: the client disconnected
+#define REC_WRITE_ERROR 5   // A write to the client failed
+#define REC_DROP 6          // The server disconnected the client
+
+struct rec_event {
+    int type;
+    int fd;
+    unsigned int seed;      // REC_SEED
+    struct in_addr addr;    // REC_ACCEPT
+    int len;                // REC_READ
+    char *data;             // REC_READ, points into the loaded recording
+};
+
+void record_open(char *path);
+void record_close(void);
+int recording(void);
+void record_seed(unsigned int seed);
+void record_accept(int fd, struct in_addr addr);
+void record_read(int fd, char *buf, int len);
+void record_write_error(int fd);
+void record_drop(int fd);
+
+struct rec_event *replay_load(char *path, int *num_events);
+
+#endif
@@ -0,0 +1,547 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "socket.h"
+#include "router.h"
+#include "admin.h"
+#include "mem.h"
+#include "clock.h"
+#include "trace.h"
+#include "stats.h"
+
+#ifndef PORT
+    #define PORT 52943
+#endif
+#define ROUTER_QUEUE 64  // The router accepts on behalf of every backend
+
+/* Router mode: this process owns the public port, greets every client and
+ * reads their name, then passes the connected socket to whichever backend
+ * has the fewest clients. A backend is a normal wordsrv running its own
+ * games, started by the router, that takes its clients over a Unix socket
+ * instead of accepting them. Backends tell the router how many clients
+ * they have whenever that changes. A backend that dies takes only its own
+ * clients with it and is started again.
+ */
+
+// Sent to a backend together with the client's socket
+struct route_msg {
+    struct in_addr ipaddr;
+    char name[MAX_NAME];
+};
+
+// Sent by a backend whenever its number of clients changes
+struct load_msg {
+    pid_t pid;          // Changes when the backend upgrades itself
+    int clients;
+};
+
+struct backend {
+    int sock;           // Our end of the socket pair, or -1 while down
+    pid_t pid;
+    int clients;        // As last reported
+    int sent;           // Clients passed to it since that report
+    long started;       // When it was last started, in ms
+};
+
+// A client who has not entered a name yet
+struct greeting {
+    int fd;
+    struct in_addr ipaddr;
+    char line[MAX_NAME + 1];  // Name and network newline read so far
+    int len;
+    int too_long;             // Dropping the rest of a line that did not fit
+    struct greeting *next;
+};
+
+static struct backend backends[MAX_BACKENDS];
+static int num_backends = 0;
+static char **backend_argv;
+static struct greeting *greetings = NULL;
+static long clients_routed = 0;
+
+static volatile sig_atomic_t router_stop = 0;
+static volatile sig_atomic_t router_upgrade = 0;
+static volatile sig_atomic_t router_trace_dump = 0;
+static int backends_traced = 0;   // Started with -T, so SIGUSR1 gets a trace
+
+static void request_router_stop(int sig) {
+    router_stop = 1;
+}
+
+static void request_router_upgrade(int sig) {
+    router_upgrade = 1;
+}
+
+static void request_router_trace_dump(int sig) {
+    router_trace_dump = 1;
+}
+
+// Tell a client something, without waiting if it is not reading
+static void say(int fd, char *msg) {
+    send(fd, msg, strlen(msg), MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+/* Start backend i: a copy of this program, which finds its end of a new
+ * socket pair through BACKEND_ENV.
+ */
+static void start_backend(int i) {
+    struct backend *b = &backends[i];
+    int sv[2];
+
+    b->started = clock_ms();
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        perror("router: socketpair");
+        return;
+    }
+    set_cloexec(sv[0]);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("router: fork");
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    } else if (pid == 0) {
+        char env[32];
+        // Only the router reads admin commands
+        int devnull = open("/dev/null", O_RDONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDIN_FILENO);
+            close(devnull);
+        }
+        snprintf(env, sizeof(env), "%d:%d", i, sv[1]);
+        setenv(BACKEND_ENV, env, 1);
+        execvp(backend_argv[0], backend_argv);
+        perror("router: exec");
+        _exit(1);
+    }
+    close(sv[1]);
+
+    // A backend that stops reading must not stall the router
+    int flags = fcntl(sv[0], F_GETFL);
+    if (flags != -1) {
+        fcntl(sv[0], F_SETFL, flags | O_NONBLOCK);
+    }
+    b->sock = sv[0];
+    b->pid = pid;
+    b->clients = 0;
+    b->sent = 0;
+    printf("Started backend %d, pid %d\n", i, pid);
+}
+
+// Forget backend i after its socket closed; it is restarted later
+static void backend_down(int i) {
+    struct backend *b = &backends[i];
+    printf("Backend %d (pid %d) is gone with its %d clients\n", i, b->pid, b->clients + b->sent);
+    close(b->sock);
+    b->sock = -1;
+}
+
+// Read a load report from backend i
+static void read_load(int i) {
+    struct backend *b = &backends[i];
+    struct load_msg load;
+
+    if (recv_fds(b->sock, &load, sizeof(load), NULL, 0) < 0) {
+        backend_down(i);
+        return;
+    }
+    b->pid = load.pid;
+    b->clients = load.clients;
+    b->sent = 0;
+}
+
+/* Pass the client in g, who entered name, to the backend picked by a hash
+ * of the name, since that backend keeps the player's statistics. Only if
+ * it is down or full does the client go to the one with the fewest
+ * clients, unless every backend is full. The router is done with the
+ * client either way.
+ */
+static void route_client(struct greeting *g, char *name) {
+    struct route_msg msg;
+    int best = -1;
+
+    int home = stats_hash(name) % num_backends;
+    if (backends[home].sock >= 0
+        && backends[home].clients + backends[home].sent < BACKEND_MAX_CLIENTS) {
+        best = home;
+    } else {
+        for (int i = 0; i < num_backends; i++) {
+            struct backend *b = &backends[i];
+            if (b->sock < 0 || b->clients + b->sent >= BACKEND_MAX_CLIENTS) {
+                continue;
+            }
+            if (best < 0 || b->clients + b->sent < backends[best].clients + backends[best].sent) {
+                best = i;
+            }
+        }
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.ipaddr = g->ipaddr;
+    strncpy(msg.name, name, MAX_NAME - 1);
+    if (best < 0 || send_fds(backends[best].sock, &msg, sizeof(msg), &g->fd, 1) < 0) {
+        say(g->fd, "No game is available right now, please try again later\r\n");
+    } else {
+        backends[best].sent++;
+        clients_routed++;
+        printf("Passed %s to backend %d\n", name, best);
+    }
+    // The backend has its own copy of the socket now
+    close(g->fd);
+}
+
+/* Read more of the name of the client in g, checking it the way
+ * read_username does. Returns 1 once the router is done with the client:
+ * it was passed on or it disconnected.
+ */
+static int read_name(struct greeting *g) {
+    int room = sizeof(g->line) - 1 - g->len;
+
+    // Peek first so only the name is taken off the socket. Whatever the
+    // client typed after it goes to the backend along with the socket.
+    int n = recv(g->fd, g->line + g->len, room, MSG_PEEK);
+    if (n < 0 && errno == EINTR) {
+        return 0;
+    }
+    if (n <= 0) {
+        printf("Disconnect from %s\n", inet_ntoa(g->ipaddr));
+        close(g->fd);
+        return 1;
+    }
+    // Only "\r\n" ends a name, as in read_username; the '\r' may have come
+    // in an earlier read
+    char *start = g->line + g->len;
+    char *newline = memchr(start, '\n', n);
+    while (newline != NULL && (newline == g->line || newline[-1] != '\r')) {
+        newline = memchr(newline + 1, '\n', start + n - newline - 1);
+    }
+    int take = newline ? newline - (g->line + g->len) + 1 : n;
+    if (read(g->fd, g->line + g->len, take) != take) {
+        close(g->fd);
+        return 1;
+    }
+    g->len += take;
+
+    if (newline == NULL) {
+        if (g->len == sizeof(g->line) - 1) {
+            if (!g->too_long) {
+                say(g->fd, "Please enter a shorter username\r\n");
+                g->too_long = 1;
+            }
+            // Keep a last '\r' in case the '\n' that ends the line is next
+            char last = g->line[g->len - 1];
+            g->len = 0;
+            if (last == '\r') {
+                g->line[g->len++] = last;
+            }
+        }
+        return 0;
+    }
+    if (g->too_long) {
+        g->too_long = 0;
+        g->len = 0;
+        return 0;
+    }
+    // A whole line: drop the network newline
+    g->len -= 2;
+    g->line[g->len] = '\0';
+    int length = g->len;
+    g->len = 0;
+
+    if (length == 0) {
+        say(g->fd, "Please enter a non-empty username\r\n");
+        return 0;
+    }
+    for (int i = 0; i < length; i++) {
+        if (g->line[i] < 32 || g->line[i] > 126) {
+            say(g->fd, "Please enter legal characters\r\n");
+            return 0;
+        }
+    }
+    // Whether the name is taken depends on the backend's game, so the
+    // backend checks that
+    route_client(g, g->line);
+    return 1;
+}
+
+// Greet a newly accepted client and wait for their name
+static void add_greeting(int fd) {
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+
+    if (fd >= FD_SETSIZE) {
+        fprintf(stderr, "router: too many connections, closing %d\n", fd);
+        close(fd);
+        return;
+    }
+    struct greeting *g = mem_alloc(MEM_CLIENTS, sizeof(struct greeting));
+    set_cloexec(fd);
+    g->fd = fd;
+    g->ipaddr.s_addr = INADDR_ANY;
+    if (getpeername(fd, (struct sockaddr *)&peer, &peer_len) == 0) {
+        g->ipaddr = peer.sin_addr;
+    }
+    g->len = 0;
+    g->too_long = 0;
+    g->next = greetings;
+    greetings = g;
+    say(fd, WELCOME_MSG);
+}
+
+// Ask every running backend to write out its trace
+static void trace_backends(void) {
+    for (int i = 0; i < num_backends; i++) {
+        if (backends[i].sock >= 0) {
+            kill(backends[i].pid, SIGUSR1);
+        }
+    }
+}
+
+/* Run as the router in front of num_backends backends, each started as
+ * argv with BACKEND_ENV set. traced says whether they were given -T.
+ * Never returns.
+ */
+void router_run(int n, int traced, char **argv) {
+    fd_set rset;
+    int admin_fd = STDIN_FILENO;
+
+    num_backends = n;
+    backends_traced = traced;
+    backend_argv = argv;
+
+    // No SA_RESTART, so select returns as soon as a signal arrives
+    struct sigaction sa;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = request_router_stop;
+    if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+    // Upgrading the router would drop the half-greeted clients, so SIGUSR2
+    // upgrades the backends instead
+    sa.sa_handler = request_router_upgrade;
+    if (sigaction(SIGUSR2, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+    // The router handles no game events, so SIGUSR1 asks the backends
+    // for their traces
+    sa.sa_handler = request_router_trace_dump;
+    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+    sa.sa_handler = SIG_IGN;
+    if (sigaction(SIGPIPE, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    struct sockaddr_in *server = init_server_addr(PORT);
+    int listenfd = set_up_server_socket(server, ROUTER_QUEUE);
+    free(server);
+    set_cloexec(listenfd);
+    if (fcntl(admin_fd, F_GETFD) == -1) {
+        admin_fd = -1;
+    }
+
+    for (int i = 0; i < num_backends; i++) {
+        start_backend(i);
+    }
+    printf("Routing clients on port %d to %d backends\n", PORT, num_backends);
+
+    while (!router_stop) {
+        if (router_upgrade) {
+            router_upgrade = 0;
+            for (int i = 0; i < num_backends; i++) {
+                if (backends[i].sock >= 0) {
+                    printf("Upgrading backend %d\n", i);
+                    kill(backends[i].pid, SIGUSR2);
+                }
+            }
+        }
+        if (router_trace_dump) {
+            router_trace_dump = 0;
+            trace_backends();
+        }
+
+        // Collect backends that exited. One that upgraded itself is no
+        // longer our child, but its socket stays open in the new process.
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+
+        // Restart backends that went down, but not in a tight loop
+        long now = clock_ms();
+        int wait_ms = -1;
+        for (int i = 0; i < num_backends; i++) {
+            if (backends[i].sock >= 0) {
+                continue;
+            }
+            long due = backends[i].started + BACKEND_RESPAWN_MS - now;
+            if (due <= 0) {
+                start_backend(i);
+            } else if (wait_ms < 0 || due < wait_ms) {
+                wait_ms = due;
+            }
+        }
+
+        FD_ZERO(&rset);
+        FD_SET(listenfd, &rset);
+        int maxfd = listenfd;
+        if (admin_fd >= 0) {
+            FD_SET(admin_fd, &rset);
+        }
+        for (int i = 0; i < num_backends; i++) {
+            if (backends[i].sock >= 0) {
+                FD_SET(backends[i].sock, &rset);
+                if (backends[i].sock > maxfd) {
+                    maxfd = backends[i].sock;
+                }
+            }
+        }
+        for (struct greeting *g = greetings; g != NULL; g = g->next) {
+            FD_SET(g->fd, &rset);
+            if (g->fd > maxfd) {
+                maxfd = g->fd;
+            }
+        }
+
+        fflush(stdout);
+        struct timeval timeout;
+        timeout.tv_sec = wait_ms / 1000;
+        timeout.tv_usec = (wait_ms % 1000) * 1000;
+        if (select(maxfd + 1, &rset, NULL, NULL, wait_ms < 0 ? NULL : &timeout) == -1) {
+            if (errno != EINTR) {
+                perror("select");
+            }
+            continue;
+        }
+
+        if (FD_ISSET(listenfd, &rset)) {
+            add_greeting(accept_connection(listenfd));
+        }
+        if (admin_fd >= 0 && FD_ISSET(admin_fd, &rset)) {
+            char buf[MAX_BUF];
+            int nbytes = read(admin_fd, buf, sizeof(buf));
+            if (nbytes <= 0) {
+                admin_fd = -1;
+            } else {
+                admin_input(buf, nbytes);
+            }
+        }
+        for (int i = 0; i < num_backends; i++) {
+            if (backends[i].sock >= 0 && FD_ISSET(backends[i].sock, &rset)) {
+                read_load(i);
+            }
+        }
+        struct greeting **gp = &greetings;
+        while (*gp != NULL) {
+            struct greeting *g = *gp;
+            if (FD_ISSET(g->fd, &rset) && read_name(g)) {
+                *gp = g->next;
+                mem_free(MEM_CLIENTS, g, sizeof(struct greeting));
+            } else {
+                gp = &g->next;
+            }
+        }
+    }
+
+    printf("Stopping backends\n");
+    for (int i = 0; i < num_backends; i++) {
+        if (backends[i].sock >= 0) {
+            kill(backends[i].pid, SIGTERM);
+        }
+    }
+    exit(0);
+}
+
+// Print what every backend is doing
+void router_report(void) {
+    if (num_backends == 0) {
+        printf("Not running as a router\n");
+        return;
+    }
+    int waiting = 0;
+    for (struct greeting *g = greetings; g != NULL; g = g->next) {
+        waiting++;
+    }
+    printf("Routed %ld clients, %d entering a name\n", clients_routed, waiting);
+    for (int i = 0; i < num_backends; i++) {
+        struct backend *b = &backends[i];
+        if (b->sock < 0) {
+            printf("  backend %d: down, restarting\n", i);
+        } else {
+            printf("  backend %d: pid %d, %d clients\n", i, b->pid, b->clients + b->sent);
+        }
+    }
+}
+
+/* The admin command "trace". The router has no events of its own, so in
+ * router mode pass the request on to the backends and say where their
+ * traces go. Returns 0 when not running as a router.
+ */
+int router_trace(void) {
+    if (num_backends == 0) {
+        return 0;
+    }
+    if (!backends_traced) {
+        printf("Tracing is off, start the router with -T to turn it on in its backends\n");
+        return 1;
+    }
+    trace_backends();
+    printf("The router keeps no trace, its backends write theirs:\n");
+    for (int i = 0; i < num_backends; i++) {
+        if (backends[i].sock >= 0) {
+            printf("  backend %d: " TRACE_FILE "\n", i, backends[i].pid);
+        }
+    }
+    return 1;
+}
+
+/* Backend: take the next client from the router on sock. Puts their
+ * address into addr and the name they entered into name, which must have
+ * room for MAX_NAME bytes. Returns their socket, or -1 if the router has
+ * gone away.
+ */
+int backend_receive(int sock, struct in_addr *addr, char *name) {
+    struct route_msg msg;
+    int fd;
+
+    if (recv_fds(sock, &msg, sizeof(msg), &fd, 1) != 1) {
+        return -1;
+    }
+    *addr = msg.ipaddr;
+    memcpy(name, msg.name, MAX_NAME);
+    name[MAX_NAME - 1] = '\0';
+    return fd;
+}
+
+/* Backend: tell the router on sock how many clients this process has, if
+ * that changed since the last report.
+ */
+void backend_report(int sock, int clients) {
+    static int last_clients = -1;
+    struct load_msg load;
+
+    if (clients == last_clients) {
+        return;
+    }
+    memset(&load, 0, sizeof(load));
+    load.pid = getpid();
+    load.clients = clients;
+    if (send_fds(sock, &load, sizeof(load), NULL, 0) == 0) {
+        last_clients = clients;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef _ROUTER_H_
+#define _ROUTER_H_
+
+#include <sys/select.h>
+
+#include "gameplay.h"
+
+// Environment variable that tells a wordsrv started by the router that it
+// is backend number i and gets its clients from descriptor fd, as "i:fd"
+#define BACKEND_ENV "WORDSRV_BACKEND"
+#define MAX_BACKENDS 64
+#define BACKEND_RESPAWN_MS 1000  // Wait at least this long before restarting a backend
+// Backends wait with select, so their clients' descriptors must stay below
+// FD_SETSIZE; the rest are for the backend's own files and sockets
+#define BACKEND_MAX_CLIENTS (FD_SETSIZE - 32)
+
+void router_run(int num_backends, int traced, char **argv);
+void router_report(void);
+int router_trace(void);
+int backend_receive(int sock, struct in_addr *addr, char *name);
+void backend_report(int sock, int clients);
+
+#endif
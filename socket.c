@@ -4,6 +4,7 @@
 #include <unistd.h>
 #include <arpa/inet.h>     /* inet_ntoa */
 #include <netdb.h>         /* gethostname */
+#include <fcntl.h>
 #include <sys/socket.h>
 
 #include "socket.h"
@@ -92,3 +93,90 @@ int accept_connection(int listenfd) {
 }
 
 
+/* Send len bytes of data as one message together with the nfds descriptors
+ * in fds over the Unix socket sock. Return 0 on success and -1 on error.
+ */
+int send_fds(int sock, void *data, int len, int *fds, int nfds) {
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * MAX_PASS_FDS)];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (nfds > 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != len) {
+        perror("sendmsg");
+        return -1;
+    }
+    return 0;
+}
+
+/* Receive one message of at most len bytes into data and up to max_fds
+ * descriptors into fds. Return the number of descriptors received, or -1
+ * on error or end of file.
+ */
+int recv_fds(int sock, void *data, int len, int *fds, int max_fds) {
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * MAX_PASS_FDS)];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = data;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    int nbytes = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (nbytes <= 0) {
+        // Nothing to say if the other end just went away
+        if (nbytes < 0) {
+            perror("recvmsg");
+        }
+        return -1;
+    }
+    if (nbytes != len || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        fprintf(stderr, "recvmsg: malformed message\n");
+        return -1;
+    }
+
+    int nfds = 0;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (nfds > max_fds) {
+            fprintf(stderr, "recvmsg: too many descriptors in message\n");
+            return -1;
+        }
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+    }
+    return nfds;
+}
+
+// Mark fd close-on-exec, so a new program only gets it if it is passed on
+void set_cloexec(int fd) {
+    int flags = fcntl(fd, F_GETFD);
+    if (flags != -1) {
+        fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+    }
+}
@@ -7,4 +7,11 @@ struct sockaddr_in *init_server_addr(int port);
 int set_up_server_socket(struct sockaddr_in *self, int num_queue);
 int accept_connection(int listenfd);
 
+// Descriptors passed in one message; the kernel allows up to SCM_MAX_FD (253)
+#define MAX_PASS_FDS 128
+
+int send_fds(int sock, void *data, int len, int *fds, int nfds);
+int recv_fds(int sock, void *data, int len, int *fds, int max_fds);
+void set_cloexec(int fd);
+
 #endif
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <libgen.h>
+
+#include "gameplay.h"
+#include "stats.h"
+#include "mem.h"
+#include "trace.h"
+
+/* Player statistics live in an in-memory hash table keyed by name. Every
+ * change appends a snapshot of the player's entry to an append-only log.
+ * The event loop only queues those snapshots; a background thread writes
+ * them in batches and syncs once per batch, so a slow disk never stalls a
+ * game. When the log holds many more records than there are players it is
+ * rewritten with one record per player, which keeps recovery at startup
+ * linear in the number of players rather than the number of games played.
+ */
+
+#define STATS_BUCKETS 1024      // Initial number of hash buckets
+#define STATS_FLUSH_MS 200      // Longest a record waits before it is written
+#define STATS_BATCH 512         // Wake the writer early once this many are queued
+#define STATS_COMPACT_RATIO 4   // Compact when the log is this many times the table
+#define STATS_COMPACT_MIN 1024  // ... and holds at least this many records
+
+// On-disk form of one player_stats entry
+struct stats_record {
+    char name[MAX_NAME];
+    int wins;
+    int games_played;
+    int guesses;
+    int correct_guesses;
+};
+
+// A growable array of records waiting to be written
+struct stats_batch {
+    struct stats_record *records;
+    int count;
+    int capacity;
+};
+
+static struct player_stats **buckets = NULL;
+static int num_buckets = 0;
+static int num_players = 0;
+static int log_records = 0;  // Records in the log file, including queued ones
+
+static char *log_path = NULL;
+static int log_open = 0;     // Checked by the event loop, which leaves log_fd to the writer
+static int log_fd = -1;      // Only the writer thread uses it while that runs
+
+// Shared with the writer thread, protected by lock
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static struct stats_batch pending;
+static struct stats_batch compact;  // Whole table, replaces the log when requested
+static int compact_requested = 0;
+static int compacting = 0;     // Requested and not yet written, or failed
+static int compact_from = 0;   // log_records when the compaction was requested
+static int compact_retry = 0;  // After a failure, wait for the log to reach this
+static int stopping = 0;
+
+
+// FNV-1a hash of a player name, also used by the router to pick a backend
+unsigned int stats_hash(char *name) {
+    unsigned int h = 2166136261u;
+    for (; *name != '\0'; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Double the number of buckets once chains get long
+static void grow_table(void) {
+    int new_size = num_buckets * 2;
+    struct player_stats **new_buckets = mem_alloc(MEM_STATS, sizeof(*new_buckets) * new_size);
+    memset(new_buckets, 0, sizeof(*new_buckets) * new_size);
+    for (int i = 0; i < num_buckets; i++) {
+        struct player_stats *s = buckets[i];
+        while (s != NULL) {
+            struct player_stats *next = s->next;
+            unsigned int b = stats_hash(s->name) & (new_size - 1);
+            s->next = new_buckets[b];
+            new_buckets[b] = s;
+            s = next;
+        }
+    }
+    mem_free(MEM_STATS, buckets, sizeof(*buckets) * num_buckets);
+    buckets = new_buckets;
+    num_buckets = new_size;
+}
+
+/* Return the entry for name, or NULL if the player has no statistics.
+ */
+struct player_stats *stats_lookup(char *name) {
+    if (buckets == NULL) {
+        return NULL;
+    }
+    struct player_stats *s = buckets[stats_hash(name) & (num_buckets - 1)];
+    for (; s != NULL; s = s->next) {
+        if (strcmp(s->name, name) == 0) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+// Return the entry for name, creating an empty one if needed
+static struct player_stats *find_or_add(char *name) {
+    struct player_stats *s = stats_lookup(name);
+    if (s != NULL) {
+        return s;
+    }
+    if (num_players >= num_buckets * 2) {
+        grow_table();
+    }
+    s = mem_alloc(MEM_STATS, sizeof(struct player_stats));
+    memset(s, 0, sizeof(struct player_stats));
+    strncpy(s->name, name, MAX_NAME - 1);
+    unsigned int b = stats_hash(s->name) & (num_buckets - 1);
+    s->next = buckets[b];
+    buckets[b] = s;
+    num_players++;
+    return s;
+}
+
+static void batch_append(struct stats_batch *batch, struct player_stats *s) {
+    if (batch->count == batch->capacity) {
+        int capacity = batch->capacity ? batch->capacity * 2 : 64;
+        batch->records = mem_realloc(MEM_STATS, batch->records,
+                                     sizeof(struct stats_record) * batch->capacity,
+                                     sizeof(struct stats_record) * capacity);
+        batch->capacity = capacity;
+    }
+    struct stats_record *r = &batch->records[batch->count++];
+    memset(r, 0, sizeof(*r));
+    strncpy(r->name, s->name, MAX_NAME - 1);
+    r->wins = s->wins;
+    r->games_played = s->games_played;
+    r->guesses = s->guesses;
+    r->correct_guesses = s->correct_guesses;
+}
+
+// Write all of buf to fd, retrying short writes
+static int write_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Make a rename in the directory holding path survive a crash
+static void sync_dir(const char *path) {
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s", path);
+    int dfd = open(dirname(dir), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0 || fsync(dfd) < 0) {
+        perror("stats: sync directory");
+    }
+    if (dfd >= 0) {
+        close(dfd);
+    }
+}
+
+/* Replace the log with the records in batch (runs on the writer thread).
+ * Returns -1 if the old log is still in place.
+ */
+static int write_compacted(struct stats_batch *batch) {
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", log_path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("stats: open");
+        return -1;
+    }
+    if (write_all(fd, batch->records, sizeof(struct stats_record) * batch->count) < 0
+        || fsync(fd) < 0) {
+        perror("stats: compact");
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    if (rename(tmp_path, log_path) < 0) {
+        perror("stats: rename");
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    sync_dir(log_path);
+    // The new file is the log from now on
+    pthread_mutex_lock(&lock);
+    int old_fd = log_fd;
+    log_fd = fd;
+    pthread_mutex_unlock(&lock);
+    close(old_fd);
+    lseek(fd, 0, SEEK_END);
+    return 0;
+}
+
+/* Background writer: wait until a batch fills up or STATS_FLUSH_MS passes,
+ * then write everything queued with a single write and a single fdatasync.
+ */
+static void *writer_main(void *arg) {
+    struct stats_batch batch = {NULL, 0, 0};
+    struct stats_batch snapshot = {NULL, 0, 0};
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += STATS_FLUSH_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (!stopping && !compact_requested && pending.count < STATS_BATCH) {
+            if (pthread_cond_timedwait(&wake, &lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        if (pending.count == 0 && !compact_requested) {
+            if (stopping) {
+                break;
+            }
+            continue;
+        }
+
+        // Take the queued work and let the event loop carry on
+        struct stats_batch tmp = batch;
+        batch = pending;
+        pending = tmp;
+        pending.count = 0;
+        int do_compact = compact_requested;
+        if (do_compact) {
+            tmp = snapshot;
+            snapshot = compact;
+            compact = tmp;
+            compact.count = 0;
+            compact_requested = 0;
+        }
+        pthread_mutex_unlock(&lock);
+
+        // The snapshot already includes everything queued before it, so if
+        // it cannot replace the log it is added to the end instead
+        int compacted = 0;
+        if (do_compact) {
+            compacted = write_compacted(&snapshot) == 0;
+            if (!compacted
+                && (write_all(log_fd, snapshot.records, sizeof(struct stats_record) * snapshot.count) < 0
+                    || fdatasync(log_fd) < 0)) {
+                perror("stats: write");
+            }
+        }
+        if (batch.count > 0) {
+            if (write_all(log_fd, batch.records, sizeof(struct stats_record) * batch.count) < 0
+                || fdatasync(log_fd) < 0) {
+                perror("stats: write");
+            }
+        }
+
+        pthread_mutex_lock(&lock);
+        if (do_compact) {
+            if (compacted) {
+                // Only what was queued since the snapshot follows it
+                log_records += snapshot.count - compact_from;
+            } else {
+                log_records += snapshot.count;
+                compact_retry = log_records + STATS_COMPACT_MIN;
+            }
+            compacting = 0;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    mem_free(MEM_STATS, batch.records, sizeof(struct stats_record) * batch.capacity);
+    mem_free(MEM_STATS, snapshot.records, sizeof(struct stats_record) * snapshot.capacity);
+    return NULL;
+}
+
+// Load every record in the log; a torn record at the end is dropped
+static void recover(void) {
+    struct stats_record records[256];
+    ssize_t n;
+    off_t good = 0;
+    while ((n = read(log_fd, records, sizeof(records))) > 0) {
+        int count = n / sizeof(struct stats_record);
+        for (int i = 0; i < count; i++) {
+            records[i].name[MAX_NAME - 1] = '\0';
+            struct player_stats *s = find_or_add(records[i].name);
+            s->wins = records[i].wins;
+            s->games_played = records[i].games_played;
+            s->guesses = records[i].guesses;
+            s->correct_guesses = records[i].correct_guesses;
+        }
+        log_records += count;
+        good += count * sizeof(struct stats_record);
+        if (n % sizeof(struct stats_record) != 0) {
+            fprintf(stderr, "stats: dropping incomplete record at end of log\n");
+            break;
+        }
+    }
+    if (n < 0) {
+        perror("stats: read");
+        exit(1);
+    }
+    if (ftruncate(log_fd, good) < 0) {
+        perror("stats: ftruncate");
+    }
+    lseek(log_fd, 0, SEEK_END);
+}
+
+/* Open (or create) the statistics log at path, load it into memory and
+ * start the writer thread.
+ */
+void stats_open(char *path) {
+    if (buckets == NULL) {
+        num_buckets = STATS_BUCKETS;
+        buckets = mem_alloc(MEM_STATS, sizeof(*buckets) * num_buckets);
+        memset(buckets, 0, sizeof(*buckets) * num_buckets);
+    }
+    log_path = path;
+    log_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (log_fd < 0) {
+        perror("stats: open");
+        exit(1);
+    }
+    log_records = 0;
+    compacting = 0;
+    compact_retry = 0;
+    recover();
+    log_open = 1;
+    printf("Loaded statistics for %d players from %s\n", num_players, path);
+
+    stopping = 0;
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0) {
+        fprintf(stderr, "stats: could not start writer thread\n");
+        exit(1);
+    }
+}
+
+/* Write out everything still queued and stop the writer thread.
+ */
+void stats_close(void) {
+    if (!log_open) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(writer, NULL);
+    close(log_fd);
+    log_fd = -1;
+    log_open = 0;
+}
+
+// Queue the new state of s, compacting the log if it has grown too long
+static void queue_record(struct player_stats *s) {
+    long traced = TRACE_START();
+    pthread_mutex_lock(&lock);
+    log_records++;
+    if (!compacting && log_records > compact_retry && log_records > STATS_COMPACT_MIN
+        && log_records > num_players * STATS_COMPACT_RATIO) {
+        // The snapshot supersedes anything still queued
+        pending.count = 0;
+        compact.count = 0;
+        for (int i = 0; i < num_buckets; i++) {
+            for (struct player_stats *t = buckets[i]; t != NULL; t = t->next) {
+                batch_append(&compact, t);
+            }
+        }
+        compact_requested = 1;
+        compacting = 1;
+        compact_from = log_records;
+        pthread_cond_signal(&wake);
+    } else {
+        batch_append(&pending, s);
+        if (pending.count >= STATS_BATCH) {
+            pthread_cond_signal(&wake);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    TRACE_STOP(TRACE_LOG, traced);
+}
+
+/* Record that the player called name finished a game, and whether they won.
+ */
+void stats_record_game(char *name, int won) {
+    if (!log_open) {  // Not open, e.g. during a replay
+        return;
+    }
+    struct player_stats *s = find_or_add(name);
+    s->games_played++;
+    if (won) {
+        s->wins++;
+    }
+    queue_record(s);
+}
+
+/* Record a guess by the player called name: a letter, or a whole word
+ * from the dictionary. It is correct if it revealed something, a new
+ * letter or the whole word.
+ */
+void stats_record_guess(char *name, int correct) {
+    if (!log_open) {  // Not open, e.g. during a replay
+        return;
+    }
+    struct player_stats *s = find_or_add(name);
+    s->guesses++;
+    if (correct) {
+        s->correct_guesses++;
+    }
+    queue_record(s);
+}
@@ -0,0 +1,25 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include "gameplay.h"
+
+#define STATS_FILE "wordsrv.stats"
+
+// Results kept for every player name across restarts
+struct player_stats {
+    char name[MAX_NAME];
+    int wins;
+    int games_played;
+    int guesses;          // Guesses in total, letters and whole words
+    int correct_guesses;  // Those that revealed letters or the whole word
+    struct player_stats *next;  // Next entry in the same hash bucket
+};
+
+void stats_open(char *path);
+void stats_close(void);
+void stats_record_game(char *name, int won);
+void stats_record_guess(char *name, int correct);
+struct player_stats *stats_lookup(char *name);
+unsigned int stats_hash(char *name);
+
+#endif
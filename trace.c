@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "trace.h"
+#include "mem.h"
+
+/* A flight recorder for latency. Every input event, and every flush of
+ * the output it produced, is timed stage by stage and the last num_events
+ * are kept in a ring. Only the event loop writes the ring and it never
+ * waits for anyone: each slot carries a sequence number that is odd while
+ * the slot is being written, and a reader that sees it change while
+ * copying the slot just skips it. A dump is written by a thread of its own,
+ * woken through a semaphore, which is safe to post from a signal handler.
+ * So a server that seems stuck can still be asked what it was doing, and
+ * the event loop does no file I/O for it. The dump is Chrome trace JSON,
+ * which chrome://tracing and Perfetto load.
+ */
+
+struct trace_span {
+    unsigned char stage;
+    unsigned int start;   // ns after the event started
+    unsigned int dur;     // ns
+};
+
+struct trace_event {
+    unsigned long seq;    // 2 * (event number + 1) once written, odd while writing
+    long start;           // ns on CLOCK_MONOTONIC
+    unsigned int dur;
+    int arg;              // fd for TRACE_INPUT, clients sent to for TRACE_FLUSH
+    unsigned char kind;
+    unsigned char num_spans;
+    unsigned short dropped;  // Stages past TRACE_SPANS
+    struct trace_span spans[TRACE_SPANS];
+};
+
+int trace_on = 0;
+
+static struct trace_event *ring = NULL;
+static int ring_size = 0;
+static unsigned long head = 0;       // Events committed so far
+static struct trace_event current;   // The event being timed
+static int in_event = 0;
+
+static sem_t dump_wanted;
+static pthread_t dumper;
+
+static const char *kind_names[] = {"input", "flush"};
+static const char *stage_names[TRACE_STAGES] = {
+    "read", "update_guessed", "status_message", "broadcast", "log"
+};
+
+// ns from start to now, as much as fits
+static unsigned int elapsed(long start, long now) {
+    long ns = now - start;
+    return ns > 0xffffffffL ? 0xffffffffU : (unsigned int)ns;
+}
+
+void trace_begin(int kind, int arg) {
+    current.start = clock_ns();
+    current.kind = kind;
+    current.arg = arg;
+    current.num_spans = 0;
+    current.dropped = 0;
+    in_event = 1;
+}
+
+// Record that stage ran from start until now in the current event
+void trace_stage(int stage, long start) {
+    if (!in_event) {
+        return;
+    }
+    if (current.num_spans == TRACE_SPANS) {
+        current.dropped++;
+        return;
+    }
+    long now = clock_ns();
+    struct trace_span *span = &current.spans[current.num_spans++];
+    span->stage = stage;
+    span->start = elapsed(current.start, start);
+    span->dur = elapsed(start, now);
+}
+
+// Put the current event into the ring, over the oldest one
+void trace_end(void) {
+    if (!in_event) {
+        return;
+    }
+    in_event = 0;
+    current.dur = elapsed(current.start, clock_ns());
+
+    struct trace_event *slot = &ring[head % ring_size];
+    __atomic_store_n(&slot->seq, 2 * head + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((char *)slot + sizeof(slot->seq), (char *)&current + sizeof(current.seq),
+           sizeof(current) - sizeof(current.seq));
+    __atomic_store_n(&slot->seq, 2 * head + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Write one complete ("X") event in Chrome trace format
+static void write_span(FILE *fp, const char *name, long start, unsigned int dur) {
+    fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f",
+            name, getpid(), start / 1000.0, dur / 1000.0);
+}
+
+/* Copy every event in the ring that is not being overwritten into copy
+ * and write them to TRACE_FILE.
+ */
+static void write_dump(struct trace_event *copy) {
+    unsigned long end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    unsigned long begin = end > ring_size ? end - ring_size : 0;
+    int n = 0;
+
+    for (unsigned long i = begin; i < end; i++) {
+        struct trace_event *slot = &ring[i % ring_size];
+        unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq != 2 * i + 2) {
+            continue;
+        }
+        memcpy(&copy[n], slot, sizeof(*slot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+            n++;
+        }
+    }
+
+    char path[64], tmp_path[80];
+    snprintf(path, sizeof(path), TRACE_FILE, getpid());
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *fp = fopen(tmp_path, "w");
+    if (fp == NULL) {
+        perror("trace: fopen");
+        return;
+    }
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    fprintf(fp, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":1,"
+                "\"args\":{\"name\":\"event loop\"}}", getpid());
+    for (int i = 0; i < n; i++) {
+        struct trace_event *ev = &copy[i];
+        write_span(fp, kind_names[ev->kind], ev->start, ev->dur);
+        if (ev->kind == TRACE_INPUT) {
+            fprintf(fp, ",\"args\":{\"fd\":%d,\"stages not kept\":%d}}", ev->arg, ev->dropped);
+        } else {
+            fprintf(fp, ",\"args\":{\"clients\":%d}}", ev->arg);
+        }
+        for (int j = 0; j < ev->num_spans; j++) {
+            struct trace_span *span = &ev->spans[j];
+            write_span(fp, stage_names[span->stage], ev->start + span->start, span->dur);
+            fprintf(fp, "}");
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+        perror("trace: write");
+        return;
+    }
+    printf("Wrote %d events to %s\n", n, path);
+    fflush(stdout);
+}
+
+static void *dumper_main(void *arg) {
+    struct trace_event *copy = malloc(sizeof(struct trace_event) * ring_size);
+    if (!copy) {
+        perror("malloc");
+        return NULL;
+    }
+    mem_note_alloc(MEM_BUFFERS, sizeof(struct trace_event) * ring_size);
+    for (;;) {
+        if (sem_wait(&dump_wanted) == -1) {
+            continue;  // EINTR
+        }
+        write_dump(copy);
+    }
+    return NULL;
+}
+
+/* Keep the last num_events events from now on. Returns 0 on success and -1
+ * if tracing could not be set up, in which case it stays off.
+ */
+int trace_configure(int num_events) {
+    if (num_events <= 0) {
+        return 0;
+    }
+    ring = calloc(num_events, sizeof(struct trace_event));
+    if (!ring) {
+        perror("calloc");
+        return -1;
+    }
+    mem_note_alloc(MEM_BUFFERS, sizeof(struct trace_event) * num_events);
+    ring_size = num_events;
+    if (sem_init(&dump_wanted, 0, 0) == -1) {
+        perror("sem_init");
+        return -1;
+    }
+    if (pthread_create(&dumper, NULL, dumper_main, NULL) != 0) {
+        fprintf(stderr, "trace: cannot start the dump thread\n");
+        return -1;
+    }
+    pthread_detach(dumper);
+    trace_on = 1;
+    return 0;
+}
+
+/* Ask for the ring to be written to TRACE_FILE. Safe to call from a signal
+ * handler.
+ */
+void trace_request_dump(void) {
+    if (trace_on) {
+        sem_post(&dump_wanted);
+    }
+}
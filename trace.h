@@ -0,0 +1,37 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "clock.h"
+
+#define TRACE_FILE "wordsrv.trace.%d.json"  // With the server's pid
+#define TRACE_SPANS 16    // Stages kept per event; later ones are only counted
+
+// What an event is
+#define TRACE_INPUT 0     // Handling input from one client
+#define TRACE_FLUSH 1     // Sending the output of one loop iteration
+
+// Stages of an event
+#define TRACE_READ 0
+#define TRACE_UPDATE 1    // update_guessed
+#define TRACE_STATUS 2    // status_message
+#define TRACE_BROADCAST 3 // broadcast, announce_turn and announce_winner
+#define TRACE_LOG 4       // Server log lines, statistics and session recording
+#define TRACE_STAGES 5
+
+extern int trace_on;
+
+/* Time a stage: long t = TRACE_START(); ...; TRACE_STOP(TRACE_READ, t);
+ * With tracing off this is a test of trace_on and nothing else.
+ */
+#define TRACE_START() (trace_on ? clock_ns() : 0)
+#define TRACE_STOP(stage, start) do { if (start) trace_stage(stage, start); } while (0)
+#define TRACE_BEGIN(kind, arg) do { if (trace_on) trace_begin(kind, arg); } while (0)
+#define TRACE_END() do { if (trace_on) trace_end(); } while (0)
+
+int trace_configure(int num_events);
+void trace_begin(int kind, int arg);
+void trace_stage(int stage, long start);
+void trace_end(void);
+void trace_request_dump(void);
+
+#endif
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "socket.h"
+#include "upgrade.h"
+#include "client.h"
+#include "mem.h"
+#include "netio.h"
+
+#define UPGRADE_MAGIC 0x57534732  // "WSG2"
+// Clients sent per message, along with their descriptors
+#define UPGRADE_BATCH MAX_PASS_FDS
+// Unsent output follows each batch in messages of at most this many bytes
+#define UPGRADE_CHUNK 4096
+
+#define UPGRADE_PLAYER 0     // Client is in game->head
+#define UPGRADE_NEW 1        // Client is still entering a name
+#define UPGRADE_SPECTATOR 2  // Client is in game->spectators
+
+// Everything the new process needs to pick up the running game.
+// Sent first, together with the listening socket.
+struct upgrade_header {
+    int magic;
+    int num_clients;
+    char word[MAX_WORD];
+    char guess[MAX_WORD];
+    int letters_guessed[NUM_LETTERS];
+    int guesses_left;
+};
+
+// One connected client, in list order so the turn order is kept
+struct upgrade_client {
+    int list;
+    int is_current;
+    struct in_addr ipaddr;
+    char name[MAX_NAME];
+    int in_len;           // Bytes of a partial line waiting in inbuf
+    char inbuf[MAX_BUF];
+    int out_len;          // Bytes of output the old process could not send
+};
+
+// Fill in rec from client p
+static void pack_client(struct upgrade_client *rec, struct client *p, int list,
+                        struct game_state *game) {
+    memset(rec, 0, sizeof(*rec));
+    rec->list = list;
+    rec->is_current = (p == game->current_player);
+    rec->ipaddr = p->ipaddr;
+    strncpy(rec->name, p->name, MAX_NAME - 1);
+    rec->in_len = p->in_len;
+    if (p->in_len > 0) {
+        memcpy(rec->inbuf, p->inbuf, p->in_len);
+    }
+    net_unsent(p->fd, &rec->out_len);
+}
+
+/* Send n clients and their descriptors as one message, then the output
+ * each of them is still owed.
+ */
+static int send_batch(int sock, struct upgrade_client *batch, int *fds, int n) {
+    if (send_fds(sock, batch, sizeof(*batch) * n, fds, n) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        int len;
+        const char *out = net_unsent(fds[i], &len);
+        for (int off = 0; off < batch[i].out_len; off += UPGRADE_CHUNK) {
+            int chunk = batch[i].out_len - off < UPGRADE_CHUNK ? batch[i].out_len - off : UPGRADE_CHUNK;
+            if (send(sock, out + off, chunk, MSG_NOSIGNAL) != chunk) {
+                perror("upgrade: send");
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Take the output owed to fd off sock and queue it for sending
+static int recv_output(int sock, int fd, int len) {
+    char buf[UPGRADE_CHUNK];
+    while (len > 0) {
+        int n = recv(sock, buf, sizeof(buf), 0);
+        if (n <= 0 || n > len) {
+            return -1;
+        }
+        net_write(fd, buf, n);
+        len -= n;
+    }
+    return 0;
+}
+
+/* Start a new copy of the server binary and hand it the listening socket,
+ * every client socket and the game state over a Unix socket.
+ * Returns only if the handover failed, in which case this process still
+ * owns every descriptor and can keep serving. Exits once the new process
+ * has confirmed that it resumed the game.
+ */
+int upgrade_handover(int listenfd, struct game_state *game,
+                     struct client *new_players, char **argv) {
+    int sv[2];
+    struct client *p;
+
+    // SOCK_SEQPACKET keeps every batch and its descriptors in one message
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        perror("upgrade: socketpair");
+        return -1;
+    }
+
+    set_cloexec(sv[0]);
+    set_cloexec(listenfd);
+    int num_clients = 0;
+    for (p = game->head; p != NULL; p = p->next, num_clients++) {
+        set_cloexec(p->fd);
+    }
+    for (p = new_players; p != NULL; p = p->next, num_clients++) {
+        set_cloexec(p->fd);
+    }
+    for (p = game->spectators; p != NULL; p = p->next, num_clients++) {
+        set_cloexec(p->fd);
+    }
+
+    printf("Upgrading: handing %d clients to %s\n", num_clients, argv[0]);
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("upgrade: fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    } else if (pid == 0) {
+        char fd_str[16];
+        close(sv[0]);
+        snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+        setenv(UPGRADE_ENV, fd_str, 1);
+        execvp(argv[0], argv);
+        perror("upgrade: exec");
+        _exit(1);
+    }
+    close(sv[1]);
+
+    struct upgrade_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = UPGRADE_MAGIC;
+    header.num_clients = num_clients;
+    memcpy(header.word, game->word, MAX_WORD);
+    memcpy(header.guess, game->guess, MAX_WORD);
+    memcpy(header.letters_guessed, game->letters_guessed, sizeof(header.letters_guessed));
+    header.guesses_left = game->guesses_left;
+    if (send_fds(sv[0], &header, sizeof(header), &listenfd, 1) < 0) {
+        goto failed;
+    }
+
+    // Not mem_alloc: running out of memory here should fail the upgrade, not the server
+    struct upgrade_client *batch = malloc(sizeof(struct upgrade_client) * UPGRADE_BATCH);
+    if (!batch) {
+        perror("malloc");
+        goto failed;
+    }
+    mem_note_alloc(MEM_BUFFERS, sizeof(struct upgrade_client) * UPGRADE_BATCH);
+    int fds[UPGRADE_BATCH];
+    int n = 0;
+    // Players first, in turn order, then the clients still at the name
+    // prompt, then spectators
+    for (int list = UPGRADE_PLAYER; list <= UPGRADE_SPECTATOR; list++) {
+        if (list == UPGRADE_PLAYER) {
+            p = game->head;
+        } else if (list == UPGRADE_NEW) {
+            p = new_players;
+        } else {
+            p = game->spectators;
+        }
+        for (; p != NULL; p = p->next) {
+            pack_client(&batch[n], p, list, game);
+            fds[n++] = p->fd;
+            if (n == UPGRADE_BATCH) {
+                if (send_batch(sv[0], batch, fds, n) < 0) {
+                    mem_free(MEM_BUFFERS, batch, sizeof(struct upgrade_client) * UPGRADE_BATCH);
+                    goto failed;
+                }
+                n = 0;
+            }
+        }
+    }
+    if (n > 0 && send_batch(sv[0], batch, fds, n) < 0) {
+        mem_free(MEM_BUFFERS, batch, sizeof(struct upgrade_client) * UPGRADE_BATCH);
+        goto failed;
+    }
+    mem_free(MEM_BUFFERS, batch, sizeof(struct upgrade_client) * UPGRADE_BATCH);
+
+    // Wait for the new process to confirm that it owns the game now
+    char ack;
+    if (read(sv[0], &ack, 1) != 1) {
+        fprintf(stderr, "upgrade: new process did not resume, keep serving\n");
+        goto failed;
+    }
+    printf("Upgrade complete, exiting\n");
+    exit(0);
+
+failed:
+    close(sv[0]);
+    // The new process may still be running; it must not touch our clients,
+    // and reaping it now keeps it from staying a zombie
+    kill(pid, SIGKILL);
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+    ;
+    return -1;
+}
+
+/* Rebuild the game and the client lists from the state sent by
+ * upgrade_handover over sock. game must already have its dictionary set up.
+ * Returns the listening socket. Exits on failure, which leaves the old
+ * process serving.
+ */
+int upgrade_resume(int sock, struct game_state *game, struct client **new_players) {
+    struct upgrade_header header;
+    int listenfd;
+
+    if (recv_fds(sock, &header, sizeof(header), &listenfd, 1) != 1
+        || header.magic != UPGRADE_MAGIC) {
+        fprintf(stderr, "upgrade: bad handover header\n");
+        exit(1);
+    }
+    memcpy(game->word, header.word, MAX_WORD);
+    memcpy(game->guess, header.guess, MAX_WORD);
+    memcpy(game->letters_guessed, header.letters_guessed, sizeof(header.letters_guessed));
+    game->guesses_left = header.guesses_left;
+    game->head = NULL;
+    game->current_player = NULL;
+    game->spectators = NULL;
+    game->changed = 1;
+
+    struct upgrade_client *batch = mem_alloc(MEM_BUFFERS, sizeof(struct upgrade_client) * UPGRADE_BATCH);
+    // Append at the tail so both lists keep their order
+    struct client **players_tail = &(game->head);
+    struct client **new_tail = new_players;
+    struct client **spectators_tail = &(game->spectators);
+    int fds[UPGRADE_BATCH];
+    int received = 0;
+    while (received < header.num_clients) {
+        int n = header.num_clients - received;
+        if (n > UPGRADE_BATCH) {
+            n = UPGRADE_BATCH;
+        }
+        if (recv_fds(sock, batch, sizeof(*batch) * n, fds, n) != n) {
+            fprintf(stderr, "upgrade: lost clients during handover\n");
+            exit(1);
+        }
+        for (int i = 0; i < n; i++) {
+            struct client *p = client_new(fds[i], batch[i].ipaddr);
+            batch[i].name[MAX_NAME - 1] = '\0';
+            client_set_name(p, batch[i].name);
+            client_set_input(p, batch[i].inbuf, batch[i].in_len);
+            if (batch[i].out_len > 0 && recv_output(sock, fds[i], batch[i].out_len) < 0) {
+                fprintf(stderr, "upgrade: lost output during handover\n");
+                exit(1);
+            }
+            if (batch[i].list == UPGRADE_PLAYER) {
+                *players_tail = p;
+                players_tail = &p->next;
+                if (batch[i].is_current) {
+                    game->current_player = p;
+                }
+            } else if (batch[i].list == UPGRADE_NEW) {
+                *new_tail = p;
+                new_tail = &p->next;
+            } else {
+                *spectators_tail = p;
+                spectators_tail = &p->next;
+            }
+        }
+        received += n;
+    }
+    mem_free(MEM_BUFFERS, batch, sizeof(struct upgrade_client) * UPGRADE_BATCH);
+
+    if (game->head != NULL && game->current_player == NULL) {
+        game->current_player = game->head;
+    }
+
+    // Let the old process go
+    if (write(sock, "", 1) != 1) {
+        perror("upgrade: ack");
+        exit(1);
+    }
+    close(sock);
+    printf("Resumed %d clients from previous process\n", received);
+    return listenfd;
+}
@@ -0,0 +1,15 @@
+#ifndef _UPGRADE_H_
+#define _UPGRADE_H_
+
+#include "gameplay.h"
+
+// Environment variable that tells a freshly exec'd wordsrv which
+// descriptor to read the old process's state from
+#define UPGRADE_ENV "WORDSRV_UPGRADE_FD"
+#define UPGRADE_DRAIN_MS 2000   // Longest the old process waits for sends to finish
+
+int upgrade_handover(int listenfd, struct game_state *game,
+                     struct client *new_players, char **argv);
+int upgrade_resume(int sock, struct game_state *game, struct client **new_players);
+
+#endif
@@ -0,0 +1,682 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "gameplay.h"
+#include "uring.h"
+#include "mem.h"
+#include "clock.h"
+#include "trace.h"
+
+/* An io_uring backend for the server loop, using the raw system calls so
+ * there is nothing extra to install.
+ *
+ * Every client has one read in flight, the listening socket has a
+ * multishot accept in flight, and everything written to a client during
+ * one loop iteration is gathered and sent with a single send. All of it is
+ * submitted with one io_uring_enter per iteration, which also waits for
+ * the next completions.
+ *
+ * Reads do not have buffers of their own. The kernel picks one from a
+ * shared set of URING_READ_BUFS only when data arrives, and it comes back
+ * once the event has been handled, so an idle client costs just its entry
+ * in conns and memory grows with the traffic, not the connections.
+ */
+
+#define URING_ENTRIES 4096      // Submission queue size
+#define URING_CQ_ENTRIES 16384  // Completion queue size
+
+// The low two bits of user_data say what completed
+#define TAG_READ 0
+#define TAG_SEND 1              // user_data is a struct uring_send pointer
+#define TAG_ACCEPT 2
+#define TAG_OTHER 3             // Timeouts, user_data >> 2 is timeout_gen, and cancellations
+#define TAG_MASK 3
+
+// One send in flight. Owned by the kernel until its completion arrives,
+// even if the client is closed in the meantime.
+struct uring_send {
+    int fd;
+    unsigned int gen;
+    char *buf;
+    int len;
+    int off;
+    int cap;   // Size of buf
+};
+
+struct uring_conn {
+    unsigned int gen;           // Bumped when fd is closed, so late completions are ignored
+    int watched;                // Open and reading
+    int reading;                // A read is in flight
+    int starved;                // In starved_fds, waiting for a free read buffer
+    int dirty;                  // Already in dirty_fds
+    struct uring_send *inflight;
+    char *out;                  // Written since the last send was submitted
+    int out_len;
+    int out_cap;
+};
+
+static int ring_fd = -1;
+
+// Submission queue
+static unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+static struct io_uring_sqe *sqes;
+static unsigned int sq_local_tail;
+static unsigned int to_submit = 0;
+
+// Completion queue
+static unsigned int *cq_head, *cq_tail, *cq_mask;
+static struct io_uring_cqe *cqes;
+
+#define URING_BGID 0            // Buffer group the reads pick from
+
+static struct uring_conn *conns = NULL;  // Indexed by descriptor, grown as needed
+static int num_conns = 0;
+static int *dirty_fds = NULL;   // Connections with output to send
+static int num_dirty = 0;
+static int *starved_fds = NULL; // Connections whose read found no free buffer
+static int num_starved = 0;
+static int reads_stopped = 0;   // Handing over: do not retry starved reads
+
+static char *read_bufs;         // URING_READ_BUFS buffers of MAX_BUF bytes
+static struct io_uring_buf_ring *buf_ring;  // Free buffers the kernel takes reads from
+static unsigned short buf_tail = 0;
+static int lent[URING_READ_BUFS];  // Buffers in the events of the last uring_wait
+static int num_lent = 0;
+
+static int listen_fd = -1;
+static int multishot = 1;       // Kernel supports multishot accept
+static int accept_armed = 0;
+static int timeout_armed = 0;
+static long timeout_due;        // clock_ms when the armed timeout fires
+static uint64_t timeout_gen = 0; // Tells the armed timeout from replaced ones
+static int reads_inflight = 0;
+static int sends_inflight = 0;
+static int sends_stopped = 0;   // Handing over: start no sends, see uring_stop_sends
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(unsigned int submit, unsigned int min_complete, unsigned int flags) {
+    return syscall(__NR_io_uring_enter, ring_fd, submit, min_complete, flags, NULL, 0);
+}
+
+// Return the entry for fd, growing the tables indexed by descriptor to fit it
+static struct uring_conn *get_conn(int fd) {
+    if (fd >= num_conns) {
+        int n = num_conns ? num_conns : 64;
+        while (n <= fd) {
+            n *= 2;
+        }
+        conns = mem_realloc(MEM_BUFFERS, conns, sizeof(struct uring_conn) * num_conns,
+                            sizeof(struct uring_conn) * n);
+        memset(conns + num_conns, 0, sizeof(struct uring_conn) * (n - num_conns));
+        dirty_fds = mem_realloc(MEM_BUFFERS, dirty_fds, sizeof(int) * num_conns, sizeof(int) * n);
+        starved_fds = mem_realloc(MEM_BUFFERS, starved_fds, sizeof(int) * num_conns, sizeof(int) * n);
+        num_conns = n;
+    }
+    return &conns[fd];
+}
+
+static uint64_t conn_data(int fd, int tag) {
+    return ((uint64_t)conns[fd].gen << 34) | ((uint64_t)fd << 2) | tag;
+}
+
+static void give_buffer(int bid);
+
+/* Set up the ring and the read buffers. Return -1 if the kernel does not
+ * support io_uring, in which case the caller should fall back to select.
+ */
+int uring_init(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+    ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (ring_fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+    }
+    char *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring_fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        perror("mmap");
+        close(ring_fd);
+        return -1;
+    }
+    char *cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            perror("mmap");
+            close(ring_fd);
+            return -1;
+        }
+    }
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        perror("mmap");
+        close(ring_fd);
+        return -1;
+    }
+    sq_head = (unsigned int *)(sq + p.sq_off.head);
+    sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+    sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+    sq_array = (unsigned int *)(sq + p.sq_off.array);
+    sq_local_tail = *sq_tail;
+    cq_head = (unsigned int *)(cq + p.cq_off.head);
+    cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+    cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Reads pick their buffer from a ring shared with the kernel. Buffers
+    // given with IORING_OP_PROVIDE_BUFFERS instead stay with a read while it
+    // waits, pinning one per idle client, so kernels without rings (before
+    // 5.19) use select.
+    buf_ring = mmap(NULL, sizeof(struct io_uring_buf) * URING_READ_BUFS, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf_ring == MAP_FAILED) {
+        perror("mmap");
+        close(ring_fd);
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)buf_ring;
+    reg.ring_entries = URING_READ_BUFS;
+    reg.bgid = URING_BGID;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register");
+        close(ring_fd);
+        return -1;
+    }
+    read_bufs = mem_alloc(MEM_BUFFERS, (size_t)URING_READ_BUFS * MAX_BUF);
+    for (int bid = 0; bid < URING_READ_BUFS; bid++) {
+        give_buffer(bid);
+    }
+    printf("Using io_uring for network I/O\n");
+    return 0;
+}
+
+// Hand queued submissions to the kernel without waiting
+static void submit(void) {
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    while (to_submit > 0) {
+        int n = sys_io_uring_enter(to_submit, 0, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("io_uring_enter");
+            exit(1);
+        }
+        to_submit -= n;
+    }
+}
+
+// Return a cleared submission queue entry, submitting first if the queue is full
+static struct io_uring_sqe *get_sqe(void) {
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= URING_ENTRIES) {
+        submit();
+    }
+    unsigned int index = sq_local_tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sq_local_tail++;
+    to_submit++;
+    return sqe;
+}
+
+// Let reads use buffer bid again
+static void give_buffer(int bid) {
+    struct io_uring_buf *b = &buf_ring->bufs[buf_tail & (URING_READ_BUFS - 1)];
+    b->addr = (uintptr_t)(read_bufs + (size_t)bid * MAX_BUF);
+    b->len = MAX_BUF;
+    b->bid = bid;
+    buf_tail++;
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+static void queue_accept(void) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    if (multishot) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+    sqe->user_data = TAG_ACCEPT;
+    accept_armed = 1;
+}
+
+static void queue_read(int fd) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->len = MAX_BUF;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = conn_data(fd, TAG_READ);
+    conns[fd].reading = 1;
+    reads_inflight++;
+}
+
+static void queue_send(struct uring_send *s) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = s->fd;
+    sqe->addr = (uintptr_t)(s->buf + s->off);
+    sqe->len = s->len - s->off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)s | TAG_SEND;
+    sends_inflight++;
+}
+
+static void queue_cancel(uint64_t target) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = TAG_OTHER;
+}
+
+/* Start accepting connections on listenfd.
+ */
+void uring_accept(int listenfd) {
+    listen_fd = listenfd;
+    queue_accept();
+}
+
+/* Keep a read in flight on fd from now on.
+ */
+void uring_watch(int fd) {
+    if (fd < 0) {
+        return;
+    }
+    struct uring_conn *c = get_conn(fd);
+    c->watched = 1;
+    reads_stopped = 0;
+    if (!c->reading) {
+        queue_read(fd);
+    }
+}
+
+int uring_watching(int fd) {
+    return fd >= 0 && fd < num_conns && conns[fd].watched;
+}
+
+/* Forget everything about fd before it is closed. A read still in flight
+ * is cancelled, and completions for the old connection are ignored.
+ */
+void uring_forget(int fd) {
+    if (fd < 0 || fd >= num_conns) {
+        return;
+    }
+    struct uring_conn *c = &conns[fd];
+    if (c->reading) {
+        queue_cancel(conn_data(fd, TAG_READ));
+    }
+    c->gen++;
+    c->watched = 0;
+    c->reading = 0;
+    c->inflight = NULL;
+    mem_free(MEM_MESSAGES, c->out, c->out_cap);
+    c->out = NULL;
+    c->out_len = c->out_cap = 0;
+}
+
+/* Queue len bytes for fd. They go out with the next uring_wait.
+ */
+int uring_queue_send(int fd, const char *buf, int len) {
+    if (fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    struct uring_conn *c = get_conn(fd);
+    if (c->out_len + len > c->out_cap) {
+        int cap = c->out_cap ? c->out_cap : MAX_MSG;
+        while (cap < c->out_len + len) {
+            cap *= 2;
+        }
+        c->out = mem_realloc(MEM_MESSAGES, c->out, c->out_cap, cap);
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, buf, len);
+    c->out_len += len;
+    if (!c->dirty) {
+        c->dirty = 1;
+        dirty_fds[num_dirty++] = fd;
+    }
+    return len;
+}
+
+// Bytes written to fd that have not been sent yet
+int uring_backlog(int fd) {
+    if (fd < 0 || fd >= num_conns) {
+        return 0;
+    }
+    struct uring_conn *c = &conns[fd];
+    int backlog = c->out_len;
+    if (c->inflight != NULL) {
+        backlog += c->inflight->len - c->inflight->off;
+    }
+    return backlog;
+}
+
+/* Start a send for everything gathered on a connection with none in flight.
+ * Traced as a flush event like net_flush, though the sends only reach the
+ * kernel with the io_uring_enter that also waits, which is not counted.
+ */
+static void flush_sends(void) {
+    if (sends_stopped || num_dirty == 0) {
+        return;
+    }
+    TRACE_BEGIN(TRACE_FLUSH, num_dirty);
+    int still_dirty = 0;
+    for (int i = 0; i < num_dirty; i++) {
+        int fd = dirty_fds[i];
+        struct uring_conn *c = &conns[fd];
+        if (c->out_len == 0) {
+            c->dirty = 0;
+            continue;
+        }
+        if (c->inflight != NULL) {
+            // Keeps its order: goes out when the current send completes
+            dirty_fds[still_dirty++] = fd;
+            continue;
+        }
+        struct uring_send *s = mem_alloc(MEM_MESSAGES, sizeof(struct uring_send));
+        s->fd = fd;
+        s->gen = c->gen;
+        s->buf = c->out;
+        s->len = c->out_len;
+        s->off = 0;
+        s->cap = c->out_cap;
+        c->out = NULL;
+        c->out_len = c->out_cap = 0;
+        c->inflight = s;
+        c->dirty = 0;
+        queue_send(s);
+    }
+    num_dirty = still_dirty;
+    TRACE_END();
+}
+
+static void release_send(struct uring_send *s) {
+    mem_free(MEM_MESSAGES, s->buf, s->cap);
+    mem_free(MEM_MESSAGES, s, sizeof(struct uring_send));
+}
+
+// Put what s did not send back in front of the output gathered since
+static void unsend(struct uring_conn *c, struct uring_send *s) {
+    int rest = s->len - s->off;
+    char *buf = mem_alloc(MEM_MESSAGES, rest + c->out_len);
+    memcpy(buf, s->buf + s->off, rest);
+    if (c->out_len > 0) {
+        memcpy(buf + rest, c->out, c->out_len);
+    }
+    mem_free(MEM_MESSAGES, c->out, c->out_cap);
+    c->out = buf;
+    c->out_len = c->out_cap = rest + c->out_len;
+    c->inflight = NULL;
+    release_send(s);
+    if (!c->dirty) {
+        c->dirty = 1;
+        dirty_fds[num_dirty++] = c - conns;
+    }
+}
+
+// Handle a send completion; return 1 if it produced an event
+static int send_done(struct uring_send *s, int res, struct uring_event *ev) {
+    sends_inflight--;
+    struct uring_conn *c = &conns[s->fd];
+    if (s->gen != c->gen) {
+        // The client was closed while this was in flight
+        release_send(s);
+        return 0;
+    }
+    if (res > 0) {
+        s->off += res;
+    }
+    if (s->off < s->len && (res > 0 || res == -ECANCELED)) {
+        if (sends_stopped) {
+            unsend(c, s);
+        } else {
+            // Short send: the rest goes out next
+            queue_send(s);
+        }
+        return 0;
+    }
+    c->inflight = NULL;
+    release_send(s);
+    if (res < 0) {
+        ev->type = URING_EV_WRITE_ERROR;
+        ev->fd = c - conns;
+        ev->res = res;
+        ev->data = NULL;
+        return 1;
+    }
+    if (c->out_len > 0 && !c->dirty) {
+        c->dirty = 1;
+        dirty_fds[num_dirty++] = c - conns;
+    }
+    return 0;
+}
+
+// Turn one completion into at most one event; return 1 if it did
+static int complete(struct io_uring_cqe *cqe, struct uring_event *ev) {
+    uint64_t data = cqe->user_data;
+    int tag = data & TAG_MASK;
+
+    if (tag == TAG_SEND) {
+        return send_done((struct uring_send *)(uintptr_t)(data & ~(uint64_t)TAG_MASK), cqe->res, ev);
+    } else if (tag == TAG_ACCEPT) {
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            accept_armed = 0;
+        }
+        if (cqe->res == -EINVAL && multishot) {
+            // Kernel older than 5.19: accept one connection at a time
+            multishot = 0;
+            queue_accept();
+            return 0;
+        }
+        if (!accept_armed && listen_fd >= 0 && cqe->res != -ECANCELED) {
+            queue_accept();
+        }
+        if (cqe->res < 0) {
+            if (cqe->res != -ECANCELED) {
+                fprintf(stderr, "accept: %s\n", strerror(-cqe->res));
+            }
+            return 0;
+        }
+        ev->type = URING_EV_ACCEPT;
+        ev->fd = cqe->res;
+        ev->res = 0;
+        ev->data = NULL;
+        return 1;
+    } else if (tag == TAG_READ) {
+        reads_inflight--;
+        int fd = (data >> 2) & 0xffffffff;
+        unsigned int gen = data >> 34;
+        struct uring_conn *c = &conns[fd];
+        int bid = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+        if (gen != (c->gen & 0x3fffffff)) {
+            if (bid >= 0) {
+                give_buffer(bid);
+            }
+            return 0;  // Closed since
+        }
+        c->reading = 0;
+        if (cqe->res == -ECANCELED) {
+            if (bid >= 0) {
+                give_buffer(bid);
+            }
+            return 0;
+        }
+        if (cqe->res == -ENOBUFS) {
+            // Every buffer is lent out: try again once some come back
+            if (!c->starved && !reads_stopped) {
+                c->starved = 1;
+                starved_fds[num_starved++] = fd;
+            }
+            return 0;
+        }
+        ev->type = URING_EV_READ;
+        ev->fd = fd;
+        ev->res = cqe->res;
+        ev->data = NULL;
+        if (bid >= 0) {
+            // Lent to the caller until the next uring_wait
+            lent[num_lent++] = bid;
+            ev->data = read_bufs + (size_t)bid * MAX_BUF;
+        }
+        return 1;
+    }
+    if (data >> 2 == timeout_gen) {
+        timeout_armed = 0;  // Fired, or ended early by another completion
+    }
+    return 0;
+}
+
+/* Submit everything queued, including pending output, then wait up to
+ * timeout_ms (forever if negative) for completions. Fill in at most
+ * max_events events and return how many there are.
+ */
+int uring_wait(int timeout_ms, struct uring_event *events, int max_events) {
+    static struct __kernel_timespec ts;
+
+    // The events from last time have been handled, so their buffers are
+    // free again, and reads that found none can have another go
+    for (int i = 0; i < num_lent; i++) {
+        give_buffer(lent[i]);
+    }
+    num_lent = 0;
+    for (int i = 0; i < num_starved; i++) {
+        struct uring_conn *c = &conns[starved_fds[i]];
+        c->starved = 0;
+        if (c->watched && !c->reading && !reads_stopped) {
+            queue_read(starved_fds[i]);
+        }
+    }
+    num_starved = 0;
+
+    flush_sends();
+    long due = clock_ms() + timeout_ms;
+    if (timeout_ms >= 0 && (!timeout_armed || due < timeout_due)) {
+        if (timeout_armed) {
+            // Only the latest timeout counts, so a shorter wait replaces it
+            struct io_uring_sqe *sqe = get_sqe();
+            sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = (timeout_gen << 2) | TAG_OTHER;
+            sqe->user_data = TAG_OTHER;
+        }
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = (uintptr_t)&ts;
+        sqe->len = 1;
+        sqe->user_data = (++timeout_gen << 2) | TAG_OTHER;
+        timeout_armed = 1;
+        timeout_due = due;
+    }
+
+    unsigned int head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+        int n = sys_io_uring_enter(to_submit, 1, IORING_ENTER_GETEVENTS);
+        if (n < 0) {
+            if (errno == EINTR) {
+                return 0;  // A signal, let the loop look at its flags
+            }
+            perror("io_uring_enter");
+            exit(1);
+        }
+        to_submit -= n;
+    } else {
+        submit();
+    }
+
+    int num_events = 0;
+    unsigned int tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && num_events < max_events) {
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        num_events += complete(cqe, &events[num_events]);
+        head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    return num_events;
+}
+
+/* Cancel the accept and every read in flight, so that the descriptors can
+ * be handed to another process. Keep calling uring_wait until uring_busy
+ * returns 0.
+ */
+void uring_cancel_all(void) {
+    if (accept_armed) {
+        queue_cancel(TAG_ACCEPT);
+    }
+    listen_fd = -1;
+    reads_stopped = 1;
+    for (int fd = 0; fd < num_conns; fd++) {
+        if (conns[fd].reading) {
+            queue_cancel(conn_data(fd, TAG_READ));
+        }
+    }
+}
+
+// Return 1 while reads, sends or the accept are still in flight
+int uring_busy(void) {
+    return reads_inflight > 0 || sends_inflight > 0 || accept_armed
+        || (num_dirty > 0 && !sends_stopped);
+}
+
+/* Give up on sending for a handover: no more sends are started and those
+ * in flight are cancelled. Once uring_busy returns 0, what was not sent is
+ * waiting in uring_unsent.
+ */
+void uring_stop_sends(void) {
+    sends_stopped = 1;
+    for (int fd = 0; fd < num_conns; fd++) {
+        if (conns[fd].inflight != NULL) {
+            queue_cancel((uintptr_t)conns[fd].inflight | TAG_SEND);
+        }
+    }
+}
+
+// Bytes kept for every descriptor: its conn and its dirty_fds and starved_fds slots
+int uring_fd_bytes(void) {
+    return sizeof(struct uring_conn) + 2 * sizeof(int);
+}
+
+// Send again, after a handover failed
+void uring_resume_sends(void) {
+    sends_stopped = 0;
+}
+
+// Output for fd that has not gone out yet; sets *len to its length
+const char *uring_unsent(int fd, int *len) {
+    if (fd < 0 || fd >= num_conns || conns[fd].inflight != NULL) {
+        *len = 0;
+        return NULL;
+    }
+    *len = conns[fd].out_len;
+    return conns[fd].out;
+}
@@ -0,0 +1,34 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#define URING_READ_BUFS 1024    // Read buffers of MAX_BUF bytes shared by all clients, a power of two
+#define URING_MAX_BACKLOG 8192  // Unsent bytes before a no-wait send gives up
+
+// What a completion means to the server
+#define URING_EV_ACCEPT 1       // fd is a new connection
+#define URING_EV_READ 2         // res bytes were read from fd into data
+#define URING_EV_WRITE_ERROR 3  // Sending to fd failed; res is -errno
+
+struct uring_event {
+    int type;
+    int fd;
+    int res;
+    char *data;
+};
+
+int uring_init(void);
+void uring_accept(int listenfd);
+void uring_watch(int fd);
+int uring_watching(int fd);
+void uring_forget(int fd);
+int uring_queue_send(int fd, const char *buf, int len);
+int uring_backlog(int fd);
+int uring_wait(int timeout_ms, struct uring_event *events, int max_events);
+void uring_cancel_all(void);
+int uring_busy(void);
+void uring_stop_sends(void);
+void uring_resume_sends(void);
+const char *uring_unsent(int fd, int *len);
+int uring_fd_bytes(void);
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gameplay.h"
+#include "wordset.h"
+#include "mem.h"
+#include "clock.h"
+
+/* A minimal perfect hash over the dictionary, so a full-word guess can be
+ * checked in constant time without keeping the words in memory. Words are
+ * hashed to 64 bits and split into buckets of WORDSET_LAMBDA on average.
+ * The table has exactly one slot per word. Buckets are placed biggest
+ * first, each with the first seed that sends all its words to free slots;
+ * a bucket of one word is simply given a free slot. A slot keeps 32 bits of
+ * its word's hash for lookups to compare, so a word that is not in the
+ * dictionary gets through about once in four billion tries. All told that
+ * is about 5 bytes per word.
+ */
+
+#define WORDSET_LAMBDA 4              // Words per bucket, on average
+#define WORDSET_DIRECT 0x80000000u    // Seed flag: the rest is the slot itself
+#define WORDSET_MAX_SEED (1u << 24)   // Seeds tried before starting over with smaller buckets
+
+// The splitmix64 finalizer, to spread every input bit over the result
+static uint64_t mix(uint64_t h) {
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static uint64_t hash_word(const char *word) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *word != '\0'; word++) {
+        h ^= (unsigned char)*word;
+        h *= 1099511628211ULL;
+    }
+    return mix(h);
+}
+
+static uint32_t bucket_of(struct word_set *set, uint64_t h) {
+    return (uint32_t)(h >> 32) % set->num_buckets;
+}
+
+static uint32_t slot_of(struct word_set *set, uint64_t h, uint32_t seed) {
+    return (uint32_t)(mix(h + seed * 0x9e3779b97f4a7c15ULL) >> 32) % set->num_words;
+}
+
+static int compare_hashes(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Descending, so the biggest buckets come first
+static int compare_sizes(const void *a, const void *b) {
+    return compare_hashes(b, a);
+}
+
+/* Fill in seeds and fingerprints for the sorted, distinct hashes, or
+ * return -1 if some bucket found no seed that fits.
+ */
+static int place_words(struct word_set *set, uint64_t *hashes) {
+    uint32_t n = set->num_words;
+    uint32_t nb = set->num_buckets;
+    int result = 0;
+
+    // Group the hashes by bucket: bucket b holds by_bucket[start[b]] up to start[b + 1]
+    uint32_t *start = mem_alloc(MEM_DICTIONARY, sizeof(uint32_t) * (nb + 1));
+    uint64_t *by_bucket = mem_alloc(MEM_DICTIONARY, sizeof(uint64_t) * n);
+    memset(start, 0, sizeof(uint32_t) * (nb + 1));
+    for (uint32_t i = 0; i < n; i++) {
+        start[bucket_of(set, hashes[i]) + 1]++;
+    }
+    for (uint32_t b = 0; b < nb; b++) {
+        start[b + 1] += start[b];
+    }
+    uint32_t *fill = mem_alloc(MEM_DICTIONARY, sizeof(uint32_t) * nb);
+    memcpy(fill, start, sizeof(uint32_t) * nb);
+    for (uint32_t i = 0; i < n; i++) {
+        by_bucket[fill[bucket_of(set, hashes[i])]++] = hashes[i];
+    }
+    mem_free(MEM_DICTIONARY, fill, sizeof(uint32_t) * nb);
+
+    // Bucket size in the high half, so sorting puts the biggest first
+    uint64_t *order = mem_alloc(MEM_DICTIONARY, sizeof(uint64_t) * nb);
+    uint32_t max_size = 0;
+    for (uint32_t b = 0; b < nb; b++) {
+        uint32_t size = start[b + 1] - start[b];
+        order[b] = (uint64_t)size << 32 | b;
+        if (size > max_size) {
+            max_size = size;
+        }
+    }
+    qsort(order, nb, sizeof(uint64_t), compare_sizes);
+
+    char *taken = mem_alloc(MEM_DICTIONARY, n);
+    memset(taken, 0, n);
+    uint32_t *slots = mem_alloc(MEM_DICTIONARY, sizeof(uint32_t) * (max_size + 1));
+    uint32_t next_free = 0;
+    for (uint32_t i = 0; i < nb && result == 0; i++) {
+        uint32_t b = (uint32_t)order[i];
+        uint32_t size = order[i] >> 32;
+        uint64_t *words = by_bucket + start[b];
+        set->seeds[b] = 0;
+        if (size == 0) {
+            continue;
+        }
+        if (size == 1) {
+            while (taken[next_free]) {
+                next_free++;
+            }
+            taken[next_free] = 1;
+            set->seeds[b] = WORDSET_DIRECT | next_free;
+            set->fingerprints[next_free] = (uint32_t)words[0];
+            continue;
+        }
+        uint32_t seed;
+        for (seed = 0; seed < WORDSET_MAX_SEED; seed++) {
+            uint32_t j;
+            for (j = 0; j < size; j++) {
+                slots[j] = slot_of(set, words[j], seed);
+                if (taken[slots[j]]) {
+                    break;
+                }
+                taken[slots[j]] = 1;
+            }
+            if (j == size) {
+                break;
+            }
+            // Undo the slots this seed took before it ran into one in use
+            while (j > 0) {
+                taken[slots[--j]] = 0;
+            }
+        }
+        if (seed == WORDSET_MAX_SEED) {
+            result = -1;
+            break;
+        }
+        set->seeds[b] = seed;
+        for (uint32_t j = 0; j < size; j++) {
+            set->fingerprints[slots[j]] = (uint32_t)words[j];
+        }
+    }
+
+    mem_free(MEM_DICTIONARY, slots, sizeof(uint32_t) * (max_size + 1));
+    mem_free(MEM_DICTIONARY, taken, n);
+    mem_free(MEM_DICTIONARY, order, sizeof(uint64_t) * nb);
+    mem_free(MEM_DICTIONARY, by_bucket, sizeof(uint64_t) * n);
+    mem_free(MEM_DICTIONARY, start, sizeof(uint32_t) * (nb + 1));
+    return result;
+}
+
+/* Build the set from the words in filename, one per line. Returns the
+ * number of distinct words.
+ */
+int wordset_build(struct word_set *set, char *filename) {
+    long began = clock_ns();
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        perror("open");
+        exit(1);
+    }
+
+    // Only the hashes are needed, and only until the table is built
+    char buf[MAX_WORD];
+    uint32_t n = 0, capacity = 0;
+    uint64_t *hashes = NULL;
+    int line_start = 1;
+    while (fgets(buf, MAX_WORD, fp) != NULL) {
+        int len = strlen(buf);
+        int newline = len > 0 && buf[len - 1] == '\n';
+        int whole = newline || feof(fp);
+        // Too long to ever be picked, so it is never the word either
+        if (!line_start || !whole) {
+            line_start = whole;
+            continue;
+        }
+        if (newline) {
+            buf[--len] = '\0';
+        }
+        if (len > 0 && buf[len - 1] == '\r') {
+            buf[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (n == capacity) {
+            uint32_t cap = capacity ? capacity * 2 : 1024;
+            hashes = mem_realloc(MEM_DICTIONARY, hashes, sizeof(uint64_t) * capacity,
+                                 sizeof(uint64_t) * cap);
+            capacity = cap;
+        }
+        hashes[n++] = hash_word(buf);
+    }
+    fclose(fp);
+
+    // Words in there twice would never fit in slots of their own
+    qsort(hashes, n, sizeof(uint64_t), compare_hashes);
+    uint32_t distinct = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (distinct == 0 || hashes[i] != hashes[distinct - 1]) {
+            hashes[distinct++] = hashes[i];
+        }
+    }
+
+    set->num_words = distinct;
+    set->fingerprints = mem_alloc(MEM_DICTIONARY, sizeof(uint32_t) * (distinct ? distinct : 1));
+    set->seeds = NULL;
+    set->num_buckets = 0;
+    if (distinct > 0) {
+        // Smaller buckets have fewer words that must fit at once
+        uint32_t nb = (distinct + WORDSET_LAMBDA - 1) / WORDSET_LAMBDA;
+        for (;;) {
+            set->seeds = mem_realloc(MEM_DICTIONARY, set->seeds, sizeof(uint32_t) * set->num_buckets,
+                                     sizeof(uint32_t) * nb);
+            set->num_buckets = nb;
+            if (place_words(set, hashes) == 0) {
+                break;
+            }
+            if (nb == distinct) {
+                fprintf(stderr, "Cannot build a hash table for %s\n", filename);
+                exit(1);
+            }
+            nb = nb * 2 < distinct ? nb * 2 : distinct;
+        }
+    }
+    mem_free(MEM_DICTIONARY, hashes, sizeof(uint64_t) * capacity);
+
+    long bytes = sizeof(uint32_t) * ((long)set->num_buckets + distinct);
+    printf("Dictionary: %u words, %ld bytes for checking guesses (%.1f per word), built in %.1f ms\n",
+           distinct, bytes, distinct ? (double)bytes / distinct : 0.0,
+           (clock_ns() - began) / 1e6);
+    return distinct;
+}
+
+// Whether word is in the set
+int wordset_contains(struct word_set *set, const char *word) {
+    if (set->num_words == 0) {
+        return 0;
+    }
+    uint64_t h = hash_word(word);
+    uint32_t seed = set->seeds[bucket_of(set, h)];
+    uint32_t slot;
+    if (seed & WORDSET_DIRECT) {
+        slot = seed & ~WORDSET_DIRECT;
+    } else {
+        slot = slot_of(set, h, seed);
+    }
+    return set->fingerprints[slot] == (uint32_t)h;
+}
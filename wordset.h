@@ -0,0 +1,17 @@
+#ifndef _WORDSET_H_
+#define _WORDSET_H_
+
+#include <stdint.h>
+
+// Every word in the dictionary, for checking full-word guesses (see wordset.c)
+struct word_set {
+    uint32_t num_words;
+    uint32_t num_buckets;
+    uint32_t *seeds;          // Per bucket: where its words were put
+    uint32_t *fingerprints;   // Per word: 32 bits of its hash, in its slot
+};
+
+int wordset_build(struct word_set *set, char *filename);
+int wordset_contains(struct word_set *set, const char *word);
+
+#endif
@@ -11,9 +11,22 @@
 #include <errno.h>
 #include <time.h>
 #include <signal.h>
+#include <fcntl.h>
 
 #include "socket.h"
 #include "gameplay.h"
+#include "upgrade.h"
+#include "stats.h"
+#include "netio.h"
+#include "record.h"
+#include "uring.h"
+#include "limit.h"
+#include "admin.h"
+#include "router.h"
+#include "client.h"
+#include "trace.h"
+#include "mem.h"
+#include "clock.h"
 
 
 #ifndef PORT
@@ -42,9 +55,28 @@ int read_guess(int fd, struct client *p, struct game_state *game, char *username
 int update_guessed(struct game_state *game, char *guess);
 int no_guess(struct game_state *game);
 int read_username(struct client *p, struct game_state *game, int fd, struct client **new_players);
+void name_entered(struct game_state *game, struct client **new_players, int cur_fd, char *username);
 void remove_new_player(struct client **top, int fd);
-void add_new_player(struct client **top, int fd, char *name);
+void add_new_player(struct client **top, struct client *p, char *name);
 void move_to_game(struct client **new_players, int fd, struct game_state *game, char *name);
+void move_to_spectators(struct client **new_players, int fd, struct game_state *game);
+int update_spectators(struct game_state *game);
+void handle_connection(struct game_state *game, struct client **new_players, int clientfd, struct in_addr addr);
+void handle_input(struct game_state *game, struct client **new_players, int cur_fd, char *dict_name);
+void handle_routed(struct game_state *game, struct client **new_players, int clientfd,
+                   struct in_addr addr, char *name);
+int count_clients(struct game_state *game, struct client *new_players);
+void replay(struct game_state *game, struct client **new_players, char *dict_name,
+            struct rec_event *events, int num_events);
+void drop_client(struct game_state *game, struct client **new_players, int fd);
+void watch_all(struct game_state *game, struct client *new_players);
+void kick_client(struct game_state *game, struct client **new_players, int fd);
+int resume_paused(struct game_state *game, struct client **new_players);
+int select_clients(struct client *list, int maxfd);
+void flush_output(struct game_state *game, struct client **new_players);
+void read_admin(void);
+void poll_uring(struct game_state *game, struct client **new_players, char *dict_name,
+                int wait_ms, int rearm);
 
 
 /* The set of socket descriptors for select to monitor.
@@ -53,6 +85,30 @@ void move_to_game(struct client **new_players, int fd, struct game_state *game,
  */
 fd_set allset;
 
+/* Set by SIGUSR2 to hand every socket and the running game over to a
+ * freshly exec'd copy of the server binary (see upgrade.c).
+ */
+volatile sig_atomic_t upgrade_requested = 0;
+
+void request_upgrade(int sig) {
+    upgrade_requested = 1;
+}
+
+// Cleared once standard input is closed, so nobody waits on it any more
+int admin_open = 1;
+
+// Set by SIGINT and SIGTERM so the server can flush its logs before exiting
+volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int sig) {
+    stop_requested = 1;
+}
+
+// SIGUSR1 writes the latest traced events out (see trace.c)
+void request_trace_dump(int sig) {
+    trace_request_dump();
+}
+
 // Check if a player exists according to where they are placed
 int check_exist(struct client **top, int fd) {
     struct client *ptr;
@@ -70,20 +126,10 @@ int check_exist(struct client **top, int fd) {
 /* Add a client to the head of the linked list
  */
 void add_player(struct client **top, int fd, struct in_addr addr) {
-    struct client *p = malloc(sizeof(struct client));
-
-    if (!p) {
-        perror("malloc");
-        exit(1);
-    }
+    struct client *p = client_new(fd, addr);
 
     printf("Adding client %s\n", inet_ntoa(addr));
 
-    p->fd = fd;
-    p->ipaddr = addr;
-    p->name[0] = '\0';
-    p->in_ptr = p->inbuf;
-    p->inbuf[0] = '\0';
     p->next = *top;
     *top = p;
 }
@@ -101,8 +147,10 @@ void remove_player(struct game_state *game, struct client **top, int fd, char *f
     // This avoids a special case for removing the head of the list
     if (*p) {
         struct client *t = (*p)->next;
+        long logged = TRACE_START();
         printf("Disconnect from %s\n", inet_ntoa((*p)->ipaddr));
         printf("Removing client %d %s during %s\n", fd, inet_ntoa((*p)->ipaddr), function_name);
+        TRACE_STOP(TRACE_LOG, logged);
 
         // Construct goodbye message if the user has a valid name
         cmp = strcmp((*p)->name, "");
@@ -116,9 +164,11 @@ void remove_player(struct game_state *game, struct client **top, int fd, char *f
             announce_turn(game);
         }
 
-        FD_CLR((*p)->fd, &allset);
-        close((*p)->fd);
-        free(*p);
+        if ((*p)->fd < FD_SETSIZE) { // io_uring serves descriptors past select's limit
+            FD_CLR((*p)->fd, &allset);
+        }
+        net_close((*p)->fd);
+        client_free(*p);
         *p = t;
         // If the last player is removed, empty current player
         if (game->current_player != NULL && game->head == NULL) {
@@ -132,59 +182,69 @@ void remove_player(struct game_state *game, struct client **top, int fd, char *f
 // Write message to all active players
 void broadcast(struct game_state *game, char *outbuf, int exclusion_fd) {
     struct client *ptr;
+    long traced = TRACE_START();
+    // Whatever players are told, spectators should eventually see
+    game->changed = 1;
     // Loop over every active player in current game state
     for (ptr = game->head; ptr != NULL; ptr = ptr->next) {
         if (ptr->fd != exclusion_fd) { // Any player other than the excluded one
-            int dp = dprintf(ptr->fd, "%s", outbuf);
+            int dp = net_printf(ptr->fd, "%s", outbuf);
             if (dp < 0) { // Disconnection
                 remove_player(game ,&(game->head), ptr->fd, "broadcast");
             }
         }
     }
+    TRACE_STOP(TRACE_BROADCAST, traced);
 }
 
 // Announce which player's turn to all active players.
 void announce_turn(struct game_state *game) {
     int dp;
     struct client *ptr;
+    long traced = TRACE_START();
+    game->changed = 1;
     // Loop over every active player in current game state
     for (ptr = game->head; ptr != NULL; ptr = ptr->next) {
         // Construct the message for sockets
         if ((game->current_player)->fd == ptr->fd) { // Current turn player
-            dp = dprintf(ptr->fd, "Your guess?\r\n");
+            dp = net_printf(ptr->fd, "Your guess?\r\n");
             if (dp < 0) { // Disconnection
                 remove_player(game, &(game->head), ptr->fd, "announce turn");
             }
             continue;
         } else { // Other players
-            dp = dprintf(ptr->fd, "It's %s's turn\r\n", (game->current_player)->name);
+            dp = net_printf(ptr->fd, "It's %s's turn\r\n", (game->current_player)->name);
             if (dp < 0) { // Disconnection
                 remove_player(game, &(game->head), ptr->fd, "announce turn");
             }
         }
     }
+    TRACE_STOP(TRACE_BROADCAST, traced);
 }
 
 // Announce winner to all active players.
 void announce_winner(struct game_state *game, struct client *winner) {
     struct client *ptr;
     int cmp, dp;
+    long traced = TRACE_START();
     // Loop over every active player in current game state
     for (ptr = game->head; ptr != NULL; ptr = ptr->next) {
         // Construct the message for sockets
         cmp = strcmp(ptr->name, winner->name);
+        stats_record_game(ptr->name, cmp == 0);
         if (cmp == 0) { // Current turn player is winner
-            dp = dprintf(ptr->fd, "Game over! You win!\n\n\nLet's start a new game\r\n");
+            dp = net_printf(ptr->fd, "Game over! You win!\n\n\nLet's start a new game\r\n");
             if (dp < 0) { // Disconnection
                 remove_player(game, &(game->head), ptr->fd, "announce winner");
             }
         } else { // Other players
-            dp = dprintf(ptr->fd, "Game over! %s won!\n\n\nLet's start a new game\r\n", winner->name);
+            dp = net_printf(ptr->fd, "Game over! %s won!\n\n\nLet's start a new game\r\n", winner->name);
             if (dp < 0) { // Disconnection
                 remove_player(game, &(game->head), ptr->fd, "announce winner");
             }
         }
     }
+    TRACE_STOP(TRACE_BROADCAST, traced);
 }
 
 // Change the current player to next active player
@@ -207,7 +267,9 @@ int find_network_newline(const char *buf, int n) {
 
 // Helper for read_guess and read_username, error checking for read
 int check_read(struct game_state *game, int fd, char *buf, int room, struct client **new_players) {
-    int num_read = read(fd, buf, room);
+    long traced = TRACE_START();
+    int num_read = net_read(fd, buf, room);
+    TRACE_STOP(TRACE_READ, traced);
     int exist_in_official;
     if (num_read == 0) { // The player didn't successfully enter input and disconnected
         exist_in_official = check_exist(&(game->head), fd);
@@ -229,50 +291,60 @@ int check_read(struct game_state *game, int fd, char *buf, int room, struct clie
     return num_read;
 }
 
-// Clear client's inbuf after operation them
-void clear_inbuf(struct client *p, int room) {
-    for (int i = 0; i < room; i++) {
-        p->inbuf[i] = '\0';
-    }
-    p->in_ptr = p->inbuf;
-}
 // Read a valid guess from player
 int read_guess(int fd, struct client *p, struct game_state *game, char *username) {
     int dp;
     int nbytes;
     // Receive a guess from user. (Code from lab10)
-    if ((nbytes = check_read(game, fd, p->in_ptr, MAX_BUF, NULL)) > 0) {
-        p->in_ptr += nbytes;
+    client_input(p);
+    if ((nbytes = check_read(game, fd, p->inbuf + p->in_len, MAX_BUF - 1 - p->in_len, NULL)) > 0) {
+        p->in_len += nbytes;
+        p->inbuf[p->in_len] = '\0';
         int where;
-        where = find_network_newline(p->in_ptr, MAX_BUF);
+        where = p->in_len >= 2 && find_network_newline(p->inbuf + p->in_len, MAX_BUF);
         // Avoid partial reads that creates too many messages for user
         if (where == 0) {
+            client_keep_input(p, MAX_BUF - 1);
             return 1;
         }
-        *(p->in_ptr - 1) = '\0';
-        *(p->in_ptr - 2) = '\0';
+        p->inbuf[p->in_len - 1] = '\0';
+        p->inbuf[p->in_len - 2] = '\0';
         // Avoid the other player who wants to steal turns
         if (fd != (game->current_player)->fd) { // The player who typed guess is not the current player
             // Print to server
             int num_read = strlen(p->inbuf) + 2;
+            long logged = TRACE_START();
             printf("[%d] Read %d bytes\n", fd, num_read);
             printf("[%d] Found newline %c\n", fd, p->inbuf[0]);
             printf("Player %s tried to guess out of turn\n", username);
+            TRACE_STOP(TRACE_LOG, logged);
             // Tell player that they should not guess when it is not the right time
-            dp = dprintf(fd, "It's not your turn to guess\r\n");
+            dp = net_printf(fd, "It's not your turn to guess\r\n");
             if (dp < 0) { // Disconnection
                 remove_player(game, &(game->head), fd, "read guess");
             }
-            clear_inbuf(p, MAX_BUF);
+            client_clear_input(p);
             return 1;
         }
-        // Either the guess is not in lowercase or already guessed or too long for a single letter
-        if (p->inbuf[0] < 97 || p->inbuf[0] > 122 || game->letters_guessed[p->inbuf[0] - 97] == 1 || p->inbuf[1] != 0) {
-            dp = dprintf(fd, "Please enter a single valid letter\r\n");
+        // A whole word has to be in the dictionary, so words cannot be brute-forced
+        if (p->inbuf[1] != 0) {
+            if (strlen(p->inbuf) >= MAX_WORD || !wordset_contains(&game->dict.words, p->inbuf)) {
+                dp = net_printf(fd, "Please enter a single valid letter or a word from the dictionary\r\n");
+                if (dp < 0) { // Disconnection
+                    remove_player(game, &(game->head), fd, "read guess");
+                }
+                client_clear_input(p);
+                return 1;
+            }
+            return 0;
+        }
+        // Either the guess is not in lowercase or already guessed
+        if (p->inbuf[0] < 97 || p->inbuf[0] > 122 || game->letters_guessed[p->inbuf[0] - 97] == 1) {
+            dp = net_printf(fd, "Please enter a single valid letter\r\n");
             if (dp < 0) { // Disconnection
                 remove_player(game, &(game->head), fd, "read guess");
             }
-            clear_inbuf(p, MAX_BUF);
+            client_clear_input(p);
             return 1;
         }
         // Nothing is wrong
@@ -284,8 +356,18 @@ int read_guess(int fd, struct client *p, struct game_state *game, char *username
 
 // Update the guessed part (from A2)
 int update_guessed(struct game_state *game, char *guess) {
+    long traced = TRACE_START();
     int correct = 0;
     int current_guess_length = strlen(game->word);
+    if (guess[1] != '\0') {
+        // A whole word reveals everything if it is right and nothing if not
+        if (strcmp(guess, game->word) == 0) {
+            strcpy(game->guess, game->word);
+            correct = 1;
+        }
+        TRACE_STOP(TRACE_UPDATE, traced);
+        return correct;
+    }
     // Loop over the hiding word
     for (int i = 0; i < current_guess_length; i++) {
         // Reveal any guessed hidden letter
@@ -294,6 +376,7 @@ int update_guessed(struct game_state *game, char *guess) {
             correct = 1;
         }
     }
+    TRACE_STOP(TRACE_UPDATE, traced);
     return correct;
 }
 
@@ -309,6 +392,11 @@ int no_guess(struct game_state *game) {
         strcat(game_over_msg, "No guesses left. Game over.\n");
         strcat(game_over_msg, "\n");
         strcat(game_over_msg, "Let's start a new game\r\n");
+        // Everybody lost this one
+        struct client *ptr;
+        for (ptr = game->head; ptr != NULL; ptr = ptr->next) {
+            stats_record_game(ptr->name, 0);
+        }
         // Broadcast
         broadcast(game, game_over_msg, -1);
         return 1;
@@ -323,46 +411,49 @@ int read_username(struct client *p, struct game_state *game, int fd, struct clie
 
     int nbytes;
     // Receive a name from user. (Code from lab10)
-    if ((nbytes = check_read(game, fd, p->in_ptr, MAX_NAME, new_players)) > 0) {
-        p->in_ptr += nbytes;
+    client_input(p);
+    if ((nbytes = check_read(game, fd, p->inbuf + p->in_len, MAX_NAME - p->in_len, new_players)) > 0) {
+        p->in_len += nbytes;
+        p->inbuf[p->in_len] = '\0';
         int where;
         // Any newline character?
-        where = find_network_newline(p->in_ptr, MAX_NAME);
+        where = p->in_len >= 2 && find_network_newline(p->inbuf + p->in_len, MAX_NAME);
         // Avoid partial reads that creates too many messages for user
         if (where == 0) {
+            client_keep_input(p, MAX_NAME);
             return 1;
         }
-        *(p->in_ptr - 1) = '\0';
-        *(p->in_ptr - 2) = '\0';
+        p->inbuf[p->in_len - 1] = '\0';
+        p->inbuf[p->in_len - 2] = '\0';
         // Avoid empty input
         int length = strlen(p->inbuf);
         if (length == 0) {
-            dp = dprintf(fd, "Please enter a non-empty username\r\n");
+            dp = net_printf(fd, "Please enter a non-empty username\r\n");
             if (dp < 0) { // Disconnection (remove from new player since they can't be in the official game)
                 remove_player(game, new_players, fd, "read username");
             }
-            clear_inbuf(p, MAX_NAME);
+            client_clear_input(p);
             return 1;
         }
         // Avoid illegal characters
         for (int i = 0; i < length; i++) {
             if (p->inbuf[i] < 32 || p->inbuf[i] > 126) {
-                dp = dprintf(fd, "Please enter legal characters\r\n");
+                dp = net_printf(fd, "Please enter legal characters\r\n");
                 if (dp < 0) { // Disconnection (remove from new player since they can't be in the official game)
                     remove_player(game, new_players, fd, "read username");
                 }
-                clear_inbuf(p, MAX_NAME);
+                client_clear_input(p);
                 return 1;
             }
         }
         // Avoid used names
         for (ptr = game->head; ptr != NULL; ptr = ptr->next) {
             if (strcmp(ptr->name, p->inbuf) == 0) { // The name is already used
-                dp = dprintf(fd, "Please enter an username that hasn't been used\r\n");
+                dp = net_printf(fd, "Please enter an username that hasn't been used\r\n");
                 if (dp < 0) { // Disconnection (remove from new player since they can't be in the official game)
                     remove_player(game, new_players, fd, "read username");
                 }
-                clear_inbuf(p, MAX_NAME);
+                client_clear_input(p);
                 return 1;
             }
         }
@@ -384,7 +475,9 @@ void remove_new_player(struct client **new_players, int fd) {
     // This avoids a special case for removing the head of the list
     if (*p) {
         struct client *t = (*p)->next;
+        long logged = TRACE_START();
         printf("Removing client %d from new players\n", fd);
+        TRACE_STOP(TRACE_LOG, logged);
         // No closing fd for new players since we still want to write in or read from this client
         // No free for the client since its pointer is just moved, not deleted
         *p = t;
@@ -394,21 +487,13 @@ void remove_new_player(struct client **new_players, int fd) {
 }
 
 // Add a client to the head of the official game
-void add_new_player(struct client **top, int fd, char *name) {
-    struct client *p = malloc(sizeof(struct client));
-
-    if (!p) {
-        perror("malloc");
-        exit(1);
-    }
-
+void add_new_player(struct client **top, struct client *p, char *name) {
+    long logged = TRACE_START();
     printf("Adding client %s\n", name);
+    TRACE_STOP(TRACE_LOG, logged);
 
-    p->fd = fd;
     // Import their names
-    strcpy(p->name, name);
-    p->in_ptr = p->inbuf;
-    p->inbuf[0] = '\0';
+    client_set_name(p, name);
     p->next = *top;
     *top = p;
 }
@@ -419,46 +504,691 @@ void move_to_game(struct client **new_players, int fd, struct game_state *game,
     struct client *ptr;
     for (ptr = *new_players; ptr != NULL; ptr = ptr->next) {
         if (ptr->fd == fd) { // Found the player to remove
-            remove_new_player(new_players, fd);
             break;
         }
     }
+    if (ptr == NULL) {
+        fprintf(stderr, "Trying to move fd %d into the game, but I don't know about it\n", fd);
+        return;
+    }
+    // The client struct is reused as is, just moved to the other list
+    remove_new_player(new_players, fd);
     // Add them to game
     if (game->head == NULL) { // There is no active player in game
-        add_new_player(&(game->head), fd, name);
-        game->current_player = ptr;
+        add_new_player(&(game->head), ptr, name);
         game->current_player = game->head;
     } else { // There are players playing
-        add_new_player(&(game->head), fd, name);
+        add_new_player(&(game->head), ptr, name);
+    }
+}
+
+// Turn a client at the name prompt into a spectator
+void move_to_spectators(struct client **new_players, int fd, struct game_state *game) {
+    struct client *ptr;
+    for (ptr = *new_players; ptr != NULL; ptr = ptr->next) {
+        if (ptr->fd == fd) {
+            break;
+        }
+    }
+    if (ptr == NULL) {
+        return;
+    }
+    // The client struct is reused as is, just moved to the other list
+    remove_new_player(new_players, fd);
+    client_set_name(ptr, "");
+    ptr->next = game->spectators;
+    game->spectators = ptr;
+    long logged = TRACE_START();
+    printf("Client %d is now spectating\n", fd);
+    TRACE_STOP(TRACE_LOG, logged);
+
+    // A spectator that cannot keep up misses updates instead of stalling the game
+    net_set_nonblocking(fd);
+    net_printf(fd, "You are now watching the game\r\n");
+    game->changed = 1;
+}
+
+/* Send every spectator a snapshot of the game if it changed and the last
+ * snapshot is at least SPECTATE_INTERVAL_MS old. The snapshot is built once
+ * and shared, so however many changes happened in between, each spectator
+ * costs one send per interval. Returns how many milliseconds select may
+ * wait before the next snapshot is due, or -1 if none is pending.
+ */
+int update_spectators(struct game_state *game) {
+    static long last_update = 0;
+    char snapshot[3 * MAX_MSG];
+    char status[2 * MAX_MSG];
+    struct client *ptr, *next;
+    int num_players = 0;
+
+    if (game->spectators == NULL || !game->changed) {
+        return -1;
+    }
+    long now = clock_ms();
+    if (now - last_update < SPECTATE_INTERVAL_MS) {
+        return SPECTATE_INTERVAL_MS - (now - last_update);
+    }
+    last_update = now;
+    game->changed = 0;
+
+    for (ptr = game->head; ptr != NULL; ptr = ptr->next) {
+        num_players++;
+    }
+    int len;
+    if (game->current_player != NULL) {
+        len = snprintf(snapshot, sizeof(snapshot), "%sPlayers: %d\r\nIt's %s's turn\r\n",
+                       status_message(status, game), num_players, game->current_player->name);
+    } else {
+        len = snprintf(snapshot, sizeof(snapshot), "%sWaiting for players\r\n",
+                       status_message(status, game));
+    }
+
+    for (ptr = game->spectators; ptr != NULL; ptr = next) {
+        next = ptr->next;
+        int n = net_send_nowait(ptr->fd, snapshot, len);
+        if (n == len || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
+            // Sent, or no room at all: this spectator just gets the next one
+            continue;
+        }
+        // Failed or only partly sent, which would garble the next snapshot
+        record_drop(ptr->fd);
+        remove_player(game, &(game->spectators), ptr->fd, "update spectators");
+    }
+    return -1;
+}
+
+// Greet a newly accepted client and add them to the list of new players
+void handle_connection(struct game_state *game, struct client **new_players, int clientfd, struct in_addr addr) {
+    record_accept(clientfd, addr);
+    limit_reset(clientfd);
+    add_player(new_players, clientfd, addr);
+    char *greeting = WELCOME_MSG;
+    if(net_write(clientfd, greeting, strlen(greeting)) == -1) {
+        fprintf(stderr, "Write to client %s failed\n", inet_ntoa(addr));
+        remove_player(game, new_players, clientfd, "main");
+    };
+}
+
+/* Backend: add a client passed on by the router, who has been greeted and
+ * entered name already. Only this process knows whether the name is taken
+ * in its game, so that is checked here and the name asked for again.
+ */
+void handle_routed(struct game_state *game, struct client **new_players, int clientfd,
+                   struct in_addr addr, char *name) {
+    struct client *ptr;
+    limit_reset(clientfd);
+    add_player(new_players, clientfd, addr);
+    for (ptr = game->head; ptr != NULL; ptr = ptr->next) {
+        if (strcmp(ptr->name, name) == 0) {
+            net_printf(clientfd, "Please enter an username that hasn't been used\r\n");
+            return;
+        }
     }
+    name_entered(game, new_players, clientfd, name);
+}
+
+// Number of connected clients of every kind, which backends report to the router
+int count_clients(struct game_state *game, struct client *new_players) {
+    struct client *p;
+    int n = 0;
+    for (p = game->head; p != NULL; p = p->next) {
+        n++;
+    }
+    for (p = new_players; p != NULL; p = p->next) {
+        n++;
+    }
+    for (p = game->spectators; p != NULL; p = p->next) {
+        n++;
+    }
+    return n;
+}
+
+/* Handle input on cur_fd, which may belong to a player, a spectator or a
+ * client who has not entered their name yet.
+ * The reason we search through the lists of clients each time is that it is
+ * possible that a client will be removed in the middle of one of the
+ * operations. This is also why we call break after handling the input.
+ * If a client has been removed the loop variables may not longer be 
+ * valid.
+ */
+void handle_input(struct game_state *game, struct client **new_players, int cur_fd, char *dict_name) {
+    struct client *p;
+    int dp, cmp, exist, num_read, correct, invalid;
+    char win_game_msg[MAX_MSG] = {'\0'};
+    char game_continue_msg[MAX_MSG] = {'\0'};
+    char guess[MAX_BUF] = {'\0'};
+    char username[MAX_NAME] = {'\0'};
+    TRACE_BEGIN(TRACE_INPUT, cur_fd);
+    // Check if this socket descriptor is an active player
+    for(p = game->head; p != NULL; p = p->next) {
+        if (cur_fd == p->fd) {
+            // TODO - handle input from an active client
+
+            // Read a valid guess from the right person (The first posible line of removing this player entirely)
+            invalid = read_guess(cur_fd, p, game, p->name);
+            // Check if the player still exists
+            exist = check_exist(&(game->head), cur_fd);
+            if (exist && invalid == 0) { // Not disconnected nor invalid
+                // Copy to guess to make code more readable
+                strcpy(guess, p->inbuf);
+                // Clear it for further reading
+                client_clear_input(p);
+                // Print to server
+                num_read = strlen(guess) + 2;
+                long logged = TRACE_START();
+                printf("[%d] Read %d bytes\n", cur_fd, num_read);
+                printf("[%d] Found newline %s\n",cur_fd, guess);
+                TRACE_STOP(TRACE_LOG, logged);
+                // Update letter guessed
+                if (guess[1] == '\0') {
+                    game->letters_guessed[guess[0] - 97] = 1;
+                }
+                // Update the word
+                correct = update_guessed(game, guess);
+                stats_record_guess(p->name, correct);
+                // Compare updated guess with the real word
+                cmp = strcmp(game->guess, game->word);
+                if (cmp == 0) { // The word is guessed out
+                    // Construct message for game over
+                    strcat(win_game_msg, "The word was ");
+                    strcat(win_game_msg, game->word);
+                    strcat(win_game_msg, "\r\n");
+                    // Broadcast
+                    broadcast(game, win_game_msg, -1);
+                    // Announce winner
+                    announce_winner(game, p);
+                    // Print to server
+                    logged = TRACE_START();
+                    printf("Game over. %s won!\nNew game\n", p->name);
+                    TRACE_STOP(TRACE_LOG, logged);
+                    // Restart game
+                    init_game(game, dict_name);
+                    // Announce turn
+                    announce_turn(game);
+                    // Print to server
+                    logged = TRACE_START();
+                    printf("It's %s's turn.\n", (game->current_player)->name);
+                    TRACE_STOP(TRACE_LOG, logged);
+                } else { // Word is not guessed out
+                    // If the guess was wrong
+                    if (correct == 0) {
+                        // Tell player not correct
+                        if (guess[1] == '\0') {
+                            dp = net_printf(cur_fd, "%c is not in the word\r\n", guess[0]);
+                        } else {
+                            dp = net_printf(cur_fd, "%s is not the word\r\n", guess);
+                        }
+                        if (dp < 0) { // Disconnection
+                            remove_player(game, &(game->head), cur_fd, "main guess wrong");
+                        }
+                        // Game Logic
+                        game->guesses_left -= 1;
+                        advance_turn(game);
+                        // Print to server
+                        logged = TRACE_START();
+                        if (guess[1] == '\0') {
+                            printf("Letter %c is not in the word\n", guess[0]);
+                        } else {
+                            printf("%s is not the word\n", guess);
+                        }
+                        TRACE_STOP(TRACE_LOG, logged);
+                    }
+                    // Construct game message since game probably continues
+                    strcat(game_continue_msg, p->name);
+                    strcat(game_continue_msg, " guesses: ");
+                    strcat(game_continue_msg, guess);
+                    strcat(game_continue_msg, "\r\n");
+                    // Broadcast to everyone
+                    broadcast(game, game_continue_msg, -1);
+                    // Construct status message
+                    char *turn_msg;
+                    int turn_msg_size;
+                    if (MAX_GUESSES > 13) { // 14 chances or above will require more space
+                        turn_msg_size = 2 * MAX_MSG;
+                    } else { // 13 chances or below will only require such space
+                        turn_msg_size = MAX_MSG;
+                    }
+                    turn_msg = mem_alloc(MEM_MESSAGES, turn_msg_size);
+                    turn_msg = status_message(turn_msg, game);
+                    // Broadcast status message
+                    broadcast(game, turn_msg, -1);
+                    announce_turn(game);
+                    // Check once: no_guess announces the end of the game
+                    int game_over = no_guess(game);
+                    // Print to server
+                    if (!game_over) {
+                        logged = TRACE_START();
+                        printf("It's %s's turn.\n", (game->current_player)->name);
+                        TRACE_STOP(TRACE_LOG, logged);
+                    }
+                    // Free
+                    mem_free(MEM_MESSAGES, turn_msg, turn_msg_size);
+                    // If the game must end due to no guessing chance left
+                    if (game_over) {
+                        logged = TRACE_START();
+                        printf("Evaluating for game_over\nNew game\n");
+                        TRACE_STOP(TRACE_LOG, logged);
+                        init_game(game, dict_name);
+                        // Announce turn
+                        announce_turn(game);
+                        // Print to server
+                        logged = TRACE_START();
+                        printf("It's %s's turn.\n", (game->current_player)->name);
+                        TRACE_STOP(TRACE_LOG, logged);
+                    }
+                }
+                // Must break here
+                break;
+            } else { //Either not exist or not valid
+                break;
+            }
+        }
+    }
+    // Spectators only watch, so anything they send is dropped
+    for (p = game->spectators; p != NULL; p = p->next) {
+        if (cur_fd == p->fd) {
+            char discard[MAX_BUF];
+            // Removes the spectator if they disconnected
+            check_read(game, cur_fd, discard, MAX_BUF, &(game->spectators));
+            break;
+        }
+    }
+    // Check if any new players are entering their names
+    for(p = *new_players; p != NULL; p = p->next) {
+        if(cur_fd == p->fd) {
+            // TODO - handle input from an new client who has not entered an acceptable name.
+            // Read a valid username
+            invalid = read_username(p, game, cur_fd, new_players);
+            // Check if the user disconnected before enterring a name
+            exist = check_exist(new_players, cur_fd);
+            if (exist && invalid == 0) { // The player didn't disconnect and entered a valid name
+                // Copy to username to make code more readable
+                strcpy(username, p->inbuf);
+                // Clear it for further reading
+                client_clear_input(p);
+                name_entered(game, new_players, cur_fd, username);
+                break;
+            } else {
+                break;
+            }
+        }
+    }
+    TRACE_END();
+}
+
+/* The client on cur_fd, who is in new_players, entered the valid name
+ * username: put them into the game, or make them a spectator.
+ */
+void name_entered(struct game_state *game, struct client **new_players, int cur_fd, char *username) {
+    int dp, num_read;
+    // Watch the game instead of joining it
+    if (strcmp(username, SPECTATE_CMD) == 0) {
+        move_to_spectators(new_players, cur_fd, game);
+        return;
+    }
+    // Put the user into official playing game
+    move_to_game(new_players, cur_fd, game, username);
+    // Print messages to server
+    num_read = strlen(username) + 2;
+    long logged = TRACE_START();
+    printf("[%d] Read %d bytes\n", cur_fd, num_read);
+    printf("[%d] Found newline %s\n", cur_fd, username);
+    TRACE_STOP(TRACE_LOG, logged);
+    // Construct joining message
+    char join_msg[MAX_MSG];
+    strcpy(join_msg, username);
+    strcat(join_msg, " has joined.\r\n");
+    // Broadcast to everyone except for who joined
+    broadcast(game, join_msg, -1);
+    // Printf to server
+    logged = TRACE_START();
+    printf("%s", join_msg);
+    printf("It's %s's turn.\n", (game->current_player)->name);
+    TRACE_STOP(TRACE_LOG, logged);
+    // Construct status message
+    char *turn_msg;
+    int turn_msg_size;
+    if (MAX_GUESSES > 13) {  // 14 chances or above will require more space
+        turn_msg_size = 2 * MAX_MSG;
+    } else {  // 13 chances or below will only require such space
+        turn_msg_size = MAX_MSG;
+    }
+    turn_msg = mem_alloc(MEM_MESSAGES, turn_msg_size);
+    turn_msg = status_message(turn_msg, game);
+    // Let the user know the current game status
+    dp = net_printf(cur_fd, "%s", turn_msg);
+    if (dp < 0) {
+        remove_player(game, &(game->head), cur_fd, "main add new player");
+    }
+    // Free
+    mem_free(MEM_MESSAGES, turn_msg, turn_msg_size);
+    // Announce the new player who should be playing
+    announce_turn(game);
+}
+
+/* Run a recorded session through the game as fast as possible and report
+ * the throughput. Nothing touches the network: input comes from the
+ * recording and output is only counted.
+ */
+void replay(struct game_state *game, struct client **new_players, char *dict_name,
+            struct rec_event *events, int num_events) {
+    long bytes_in = 0;
+    int num_reads = 0;
+    double start = clock_seconds();
+
+    // The first event is the seed, which main has already used
+    for (int i = 1; i < num_events; i++) {
+        struct rec_event *ev = &events[i];
+        if (ev->type == REC_ACCEPT) {
+            handle_connection(game, new_players, ev->fd, ev->addr);
+        } else if (ev->type == REC_READ || ev->type == REC_CLOSE) {
+            net_set_input(ev->fd, ev->data, ev->len);
+            handle_input(game, new_players, ev->fd, dict_name);
+            bytes_in += ev->len;
+            num_reads++;
+        } else if (ev->type == REC_WRITE_ERROR || ev->type == REC_DROP) {
+            // Output is sent after each round of input, so this is where
+            // the live server found out about it too
+            drop_client(game, new_players, ev->fd);
+        }
+    }
+
+    double elapsed = clock_seconds() - start;
+    fflush(stdout);
+    fprintf(stderr, "Replayed %d events (%d reads, %ld bytes in, %ld bytes out) in %.3f s\n",
+            num_events, num_reads, bytes_in, net_bytes_out(), elapsed);
+    if (elapsed > 0) {
+        fprintf(stderr, "%.0f events/s\n", num_events / elapsed);
+    }
+}
+
+// Remove whichever kind of client fd belongs to, after a write to it failed
+void drop_client(struct game_state *game, struct client **new_players, int fd) {
+    if (check_exist(&(game->head), fd)) {
+        if (game->current_player != NULL && game->current_player->fd == fd) {
+            // Give turn to next active player
+            advance_turn(game);
+        }
+        remove_player(game, &(game->head), fd, "send");
+    } else if (check_exist(new_players, fd)) {
+        remove_player(game, new_players, fd, "send");
+    } else if (check_exist(&(game->spectators), fd)) {
+        remove_player(game, &(game->spectators), fd, "send");
+    }
+}
+
+/* The io_uring counterpart of one select call and the handling after it:
+ * submit everything queued, wait for completions and handle each one.
+ * Reads are only re-armed if rearm is set, which it is not while the
+ * server is draining its sockets for an upgrade.
+ */
+void poll_uring(struct game_state *game, struct client **new_players, char *dict_name,
+                int wait_ms, int rearm) {
+    struct uring_event events[256];
+    int n = uring_wait(wait_ms, events, 256);
+
+    for (int i = 0; i < n; i++) {
+        struct uring_event *ev = &events[i];
+        if (ev->type == URING_EV_ACCEPT) {
+            printf("A new client is connecting\n");
+            // A multishot accept has no room for each peer's address
+            struct sockaddr_in peer;
+            socklen_t peer_len = sizeof(peer);
+            struct in_addr addr;
+            addr.s_addr = INADDR_ANY;
+            if (getpeername(ev->fd, (struct sockaddr *)&peer, &peer_len) == 0) {
+                addr = peer.sin_addr;
+            }
+            // Watch first: a failed greeting closes the client again
+            if (rearm) {
+                uring_watch(ev->fd);
+            }
+            handle_connection(game, new_players, ev->fd, addr);
+        } else if (ev->type == URING_EV_READ && ev->fd == STDIN_FILENO && admin_open) {
+            if (ev->res > 0) {
+                admin_input(ev->data, ev->res);
+                if (rearm) {
+                    uring_watch(STDIN_FILENO);
+                }
+            } else {
+                admin_open = 0;
+            }
+        } else if (ev->type == URING_EV_READ) {
+            // The data is already here, so a paused client only stops
+            // getting further reads
+            int verdict = limit_take(ev->fd, clock_ms());
+            if (verdict == LIMIT_KICK) {
+                kick_client(game, new_players, ev->fd);
+                continue;
+            }
+            net_set_input(ev->fd, ev->data, ev->res);
+            // One read may hold more than the handler takes at a time
+            do {
+                handle_input(game, new_players, ev->fd, dict_name);
+            } while (net_input_left(ev->fd));
+            if (rearm && verdict == LIMIT_OK && uring_watching(ev->fd)) {
+                uring_watch(ev->fd);
+            }
+        } else if (ev->type == URING_EV_WRITE_ERROR) {
+            fprintf(stderr, "Write to client %d failed: %s\n", ev->fd, strerror(-ev->res));
+            record_write_error(ev->fd);
+            drop_client(game, new_players, ev->fd);
+        }
+    }
+}
+
+// Start io_uring reads for every connected client and the admin console
+void watch_all(struct game_state *game, struct client *new_players) {
+    struct client *p;
+    if (admin_open) {
+        uring_watch(STDIN_FILENO);
+    }
+    for (p = game->head; p != NULL; p = p->next) {
+        uring_watch(p->fd);
+    }
+    for (p = new_players; p != NULL; p = p->next) {
+        uring_watch(p->fd);
+    }
+    for (p = game->spectators; p != NULL; p = p->next) {
+        uring_watch(p->fd);
+    }
+}
+
+// Disconnect a client that keeps sending faster than the rate limit
+void kick_client(struct game_state *game, struct client **new_players, int fd) {
+    printf("Disconnecting client %d for sending too fast\n", fd);
+    net_printf(fd, "You are sending too fast. Goodbye\r\n");
+    // Replay has no rate limit, so it needs to be told
+    record_drop(fd);
+    drop_client(game, new_players, fd);
+}
+
+// Return 1 if fd belongs to any kind of client
+int is_client(struct game_state *game, struct client **new_players, int fd) {
+    return check_exist(&(game->head), fd) || check_exist(new_players, fd)
+        || check_exist(&(game->spectators), fd);
+}
+
+/* Add the clients in list to allset and return maxfd raised to cover
+ * them. A server upgraded from io_uring may have clients past select's
+ * limit; those are left to io_uring.
+ */
+int select_clients(struct client *list, int maxfd) {
+    for (struct client *p = list; p != NULL; p = p->next) {
+        if (p->fd >= FD_SETSIZE) {
+            continue;
+        }
+        FD_SET(p->fd, &allset);
+        if (p->fd > maxfd) {
+            maxfd = p->fd;
+        }
+    }
+    return maxfd;
+}
+
+/* Start reading again from clients whose rate limit pause is over.
+ * Returns how many ms until the next one is due, or -1 if none is paused.
+ */
+int resume_paused(struct game_state *game, struct client **new_players) {
+    int fds[64];
+    long now = clock_ms();
+    int n = limit_resume(now, fds, 64);
+    for (int i = 0; i < n; i++) {
+        // The client may have gone away while paused
+        if (!is_client(game, new_players, fds[i])) {
+            continue;
+        }
+        if (net_get_mode() == NET_URING) {
+            if (uring_watching(fds[i])) {
+                uring_watch(fds[i]);
+            }
+        } else if (fds[i] < FD_SETSIZE) {
+            FD_SET(fds[i], &allset);
+        }
+    }
+    return limit_next_resume(now);
+}
+
+// Read a command typed on the server's standard input
+void read_admin(void) {
+    char buf[MAX_BUF];
+    int n = read(STDIN_FILENO, buf, sizeof(buf));
+    if (n <= 0) {
+        // Running without a terminal, e.g. in the background
+        FD_CLR(STDIN_FILENO, &allset);
+        admin_open = 0;
+        return;
+    }
+    admin_input(buf, n);
+}
+
+/* Send the output gathered during this loop iteration. Clients whose
+ * send failed are dropped, which tells the others, so repeat until
+ * nothing is left.
+ */
+void flush_output(struct game_state *game, struct client **new_players) {
+    int failed[64];
+    int n;
+    while ((n = net_flush(failed, 64)) > 0) {
+        for (int i = 0; i < n; i++) {
+            fprintf(stderr, "Write to client %d failed\n", failed[i]);
+            drop_client(game, new_players, failed[i]);
+        }
+    }
+}
+
+void usage(char *name) {
+    fprintf(stderr,"Usage: %s [-R rate] [-B burst] [-K strikes] [-i select|uring] [-T events]\n"
+                   "          [-b backends | -r recording | -p recording] <dictionary filename>\n", name);
+    fprintf(stderr,"  -R RATE  reads per second allowed from one client, 0 for no limit (default %.0f)\n", LIMIT_RATE);
+    fprintf(stderr,"  -B N     reads a client may send at once before it is throttled (default %d)\n", LIMIT_BURST);
+    fprintf(stderr,"  -K N     throttles before a client is disconnected, 0 for never (default %d)\n", LIMIT_STRIKES);
+    fprintf(stderr,"  -i IO    how to wait for network I/O (default select; uring falls back\n"
+                   "           to select if the kernel does not support it)\n");
+    fprintf(stderr,"  -T N     keep timings of the last N events, written out on SIGUSR1\n");
+    fprintf(stderr,"  -b N     run as a router that spreads clients over N backend processes\n");
+    fprintf(stderr,"  -r FILE  record every connection, read and the random seed to FILE\n");
+    fprintf(stderr,"  -p FILE  replay FILE through the game offline and report throughput\n");
+    exit(1);
 }
 
 int main(int argc, char **argv) {
     int clientfd, maxfd, nready;
-    struct client *p;
     struct sockaddr_in q;
     fd_set rset;
-    
-    if(argc != 2){
-        fprintf(stderr,"Usage: %s <dictionary filename>\n", argv[0]);
+    // Checked before anything else is opened, which could take fd 0
+    if (fcntl(STDIN_FILENO, F_GETFD) == -1) {
+        admin_open = 0;
+    }
+    char *record_path = NULL;
+    char *replay_path = NULL;
+    int use_uring = 0;
+    double limit_rate = LIMIT_RATE;
+    int limit_burst = LIMIT_BURST;
+    int limit_strikes = LIMIT_STRIKES;
+    int num_backends = 0;
+    int trace_events = 0;
+    int opt;
+
+    memset(&q, 0, sizeof(q));
+    while ((opt = getopt(argc, argv, "R:B:K:i:b:T:r:p:")) != -1) {
+        if (opt == 'R') {
+            limit_rate = atof(optarg);
+        } else if (opt == 'B') {
+            limit_burst = atoi(optarg);
+        } else if (opt == 'K') {
+            limit_strikes = atoi(optarg);
+        } else if (opt == 'i' && (strcmp(optarg, "select") == 0 || strcmp(optarg, "uring") == 0)) {
+            use_uring = (strcmp(optarg, "uring") == 0);
+        } else if (opt == 'b' && atoi(optarg) > 0 && atoi(optarg) <= MAX_BACKENDS) {
+            num_backends = atoi(optarg);
+        } else if (opt == 'T' && atoi(optarg) > 0) {
+            trace_events = atoi(optarg);
+        } else if (opt == 'r') {
+            record_path = optarg;
+        } else if (opt == 'p') {
+            replay_path = optarg;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if(optind != argc - 1 || (record_path != NULL) + (replay_path != NULL) + (num_backends > 0) > 1){
+        usage(argv[0]);
+    }
+    char *dict_name = argv[optind];
+    limit_configure(limit_rate, limit_burst, limit_strikes);
+
+    // Started by a router as backend number backend (see router.c)
+    int backend = -1;
+    int router_fd = -1;
+    char *backend_env = getenv(BACKEND_ENV);
+    if (backend_env != NULL && sscanf(backend_env, "%d:%d", &backend, &router_fd) != 2) {
+        fprintf(stderr, "Bad %s: %s\n", BACKEND_ENV, backend_env);
         exit(1);
     }
+    // The router only passes clients on; its backends trace their events
+    if (num_backends == 0 || backend >= 0) {
+        trace_configure(trace_events);
+    }
     
     // Create and initialize the game state
     struct game_state game;
 
-    srandom((unsigned int)time(NULL));
+    // A replay must pick the same words as the recorded session
+    unsigned int seed = (unsigned int)time(NULL);
+    if (backend >= 0) {
+        // Backends started together should still pick different words
+        seed ^= getpid();
+    }
+    struct rec_event *events = NULL;
+    int num_events = 0;
+    if (replay_path != NULL) {
+        events = replay_load(replay_path, &num_events);
+        if (num_events == 0 || events[0].type != REC_SEED) {
+            fprintf(stderr, "%s does not start with a random seed\n", replay_path);
+            exit(1);
+        }
+        seed = events[0].seed;
+        net_set_mode(NET_REPLAY);
+    }
+    srandom(seed);
     // Set up the file pointer outside of init_game because we want to 
     // just rewind the file when we need to pick a new word
     game.dict.fp = NULL;
-    game.dict.size = get_file_length(argv[1]);
+    game.dict.size = get_file_length(dict_name);
+    // Full-word guesses are checked against this; the router never takes any
+    if (num_backends == 0 || backend >= 0) {
+        wordset_build(&game.dict.words, dict_name);
+    }
 
-    init_game(&game, argv[1]);
+    init_game(&game, dict_name);
     
     // head and current_player also don't change when a subsequent game is
     // started so we initialize them here.
     game.head = NULL;
     game.current_player = NULL;
+    game.spectators = NULL;
+    game.changed = 0;
     
     /* A list of client who have not yet entered their name.  This list is
      * kept separate from the list of active players in the game, because
@@ -467,27 +1197,199 @@ int main(int argc, char **argv) {
      * they have a name.
      */
     struct client *new_players = NULL;
+
+    if (replay_path != NULL) {
+        replay(&game, &new_players, dict_name, events, num_events);
+        return 0;
+    }
+    // The dictionary is fine, so the backends will be too
+    if (num_backends > 0 && backend < 0) {
+        router_run(num_backends, trace_events > 0, argv);
+    }
+    // Each backend compacts its own statistics log, so they cannot share
+    // one. The router sends a name to the same backend every time, so each
+    // player's results stay in one of them.
+    char stats_path[64];
+    if (backend >= 0) {
+        snprintf(stats_path, sizeof(stats_path), "%s.%d", STATS_FILE, backend);
+    } else {
+        snprintf(stats_path, sizeof(stats_path), "%s", STATS_FILE);
+    }
+    stats_open(stats_path);
     
-    struct sockaddr_in *server = init_server_addr(PORT);
-    int listenfd = set_up_server_socket(server, MAX_QUEUE);
+    int listenfd;
+    char *handover = getenv(UPGRADE_ENV);
+    if (handover != NULL) {
+        // Started by upgrade_handover: take over the old process's sockets
+        unsetenv(UPGRADE_ENV);
+        listenfd = upgrade_resume(atoi(handover), &game, &new_players);
+        // A replay could not rebuild the state we were handed
+        if (record_path != NULL) {
+            fprintf(stderr, "Not recording: state was handed over by a previous process\n");
+        }
+    } else if (backend >= 0) {
+        // New clients come from the router instead of being accepted
+        listenfd = router_fd;
+    } else {
+        struct sockaddr_in *server = init_server_addr(PORT);
+        listenfd = set_up_server_socket(server, MAX_QUEUE);
+        free(server);
+        if (record_path != NULL) {
+            record_open(record_path);
+            record_seed(seed);
+        }
+    }
     
     // initialize allset and add listenfd to the
     // set of file descriptors passed into select
     FD_ZERO(&allset);
     FD_SET(listenfd, &allset);
+    // Admin commands are typed on standard input, if there is one
+    if (admin_open) {
+        FD_SET(STDIN_FILENO, &allset);
+    }
     // maxfd identifies how far into the set to search
     maxfd = listenfd;
+    // Clients resumed from an upgrade are already connected
+    maxfd = select_clients(game.head, maxfd);
+    maxfd = select_clients(new_players, maxfd);
+    maxfd = select_clients(game.spectators, maxfd);
+
+    // Backends get their clients with recvmsg, so they stay with select
+    int router_open = (backend >= 0);
+    if (use_uring && router_open) {
+        fprintf(stderr, "Backend %d uses select\n", backend);
+    } else if (use_uring) {
+        if (uring_init() == 0) {
+            net_set_mode(NET_URING);
+            uring_accept(listenfd);
+            watch_all(&game, new_players);
+        } else {
+            fprintf(stderr, "io_uring is not available, using select\n");
+        }
+    }
+
+    // No SA_RESTART, so select returns as soon as an upgrade is requested
+    struct sigaction usr2;
+    usr2.sa_handler = request_upgrade;
+    usr2.sa_flags = 0;
+    sigemptyset(&usr2.sa_mask);
+    if (sigaction(SIGUSR2, &usr2, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+    struct sigaction dump;
+    dump.sa_handler = request_trace_dump;
+    dump.sa_flags = SA_RESTART;
+    sigemptyset(&dump.sa_mask);
+    if (sigaction(SIGUSR1, &dump, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+    struct sigaction stop;
+    stop.sa_handler = request_stop;
+    stop.sa_flags = 0;
+    sigemptyset(&stop.sa_mask);
+    if (sigaction(SIGINT, &stop, NULL) == -1 || sigaction(SIGTERM, &stop, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+    // To ignore SIGPIPE, before anything is written to a client or the router
+    struct sigaction sa;
+    sa.sa_handler = SIG_IGN;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPIPE, &sa, NULL) == -1) {
+        perror("sigaction");
+        exit(1);
+    }
+
+    while (!stop_requested) {
+        if (upgrade_requested) {
+            upgrade_requested = 0;
+            // io_uring has reads in flight that could take input meant for
+            // the new process, so cancel them and let the sends finish. A
+            // client that stops reading cannot hold the upgrade up: after
+            // UPGRADE_DRAIN_MS the new process gets whatever is unsent.
+            if (net_get_mode() == NET_URING) {
+                uring_cancel_all();
+                long give_up = clock_ms() + UPGRADE_DRAIN_MS;
+                int stopped = 0;
+                while (uring_busy()) {
+                    long left = give_up - clock_ms();
+                    if (left <= 0 && !stopped) {
+                        uring_stop_sends();
+                        stopped = 1;
+                    }
+                    poll_uring(&game, &new_players, dict_name, stopped ? -1 : (int)left, 0);
+                }
+            }
+            // The new process loads the statistics, so write them out first,
+            // including any games that finished while draining
+            stats_close();
+            // Only returns if the new process could not take over
+            upgrade_handover(listenfd, &game, new_players, argv);
+            stats_open(stats_path);
+            if (net_get_mode() == NET_URING) {
+                uring_resume_sends();
+                uring_accept(listenfd);
+                watch_all(&game, new_players);
+            }
+        }
+
+        // Let the router know if clients came or went
+        if (router_open) {
+            backend_report(listenfd, count_clients(&game, new_players));
+        }
+
+        // Wake up in time for the next spectator snapshot, if one is due
+        int wait_ms = update_spectators(&game);
+        // ... or for the next rate limited client to be read again
+        int resume_ms = resume_paused(&game, &new_players);
+        if (resume_ms >= 0 && (wait_ms < 0 || resume_ms < wait_ms)) {
+            wait_ms = resume_ms;
+        }
+        if (net_get_mode() == NET_URING) {
+            poll_uring(&game, &new_players, dict_name, wait_ms, 1);
+            continue;
+        }
+        struct timeval timeout;
+        timeout.tv_sec = wait_ms / 1000;
+        timeout.tv_usec = (wait_ms % 1000) * 1000;
 
-    while (1) {
         // make a copy of the set before we pass it into select
         rset = allset;
-        nready = select(maxfd + 1, &rset, NULL, NULL, NULL);
+        nready = select(maxfd + 1, &rset, NULL, NULL, wait_ms < 0 ? NULL : &timeout);
         if (nready == -1) {
-            perror("select");
+            // A signal, e.g. to stop or upgrade, is handled at the top of the loop
+            if (errno != EINTR) {
+                perror("select");
+            }
             continue;
         }
 
-        if (FD_ISSET(listenfd, &rset)){
+        if (router_open && FD_ISSET(listenfd, &rset)) {
+            char name[MAX_NAME];
+            clientfd = backend_receive(listenfd, &q.sin_addr, name);
+            if (clientfd < 0) {
+                // Keep the games going for the clients we have
+                printf("The router is gone, no new clients will arrive\n");
+                FD_CLR(listenfd, &allset);
+                router_open = 0;
+            } else if (clientfd >= FD_SETSIZE) {
+                // Backends always use select; the router should not send
+                // this many, see BACKEND_MAX_CLIENTS
+                fprintf(stderr, "Too many clients, closing %d from the router\n", clientfd);
+                close(clientfd);
+            } else {
+                printf("Client %d arrived from the router\n", clientfd);
+                FD_SET(clientfd, &allset);
+                if (clientfd > maxfd) {
+                    maxfd = clientfd;
+                }
+                handle_routed(&game, &new_players, clientfd, q.sin_addr, name);
+            }
+        } else if (FD_ISSET(listenfd, &rset)){
             printf("A new client is connecting\n");
             clientfd = accept_connection(listenfd);
 
@@ -496,196 +1398,38 @@ int main(int argc, char **argv) {
                 maxfd = clientfd;
             }
             // printf("Connection from %s\n", inet_ntoa(q.sin_addr));
-            add_player(&new_players, clientfd, q.sin_addr);
-            char *greeting = WELCOME_MSG;
-            if(write(clientfd, greeting, strlen(greeting)) == -1) {
-                fprintf(stderr, "Write to client %s failed\n", inet_ntoa(q.sin_addr));
-                remove_player(&game, &new_players, clientfd, "main");
-            };
-        }
-        
-        // To ignore SIGPIPE
-        struct sigaction sa;
-        sa.sa_handler = SIG_IGN;
-        sa.sa_flags = 0;
-        sigemptyset(&sa.sa_mask);
-        if(sigaction(SIGPIPE, &sa, NULL) == -1) {
-            perror("sigaction");
-            exit(1);
+            handle_connection(&game, &new_players, clientfd, q.sin_addr);
         }
-        
-        /* Check which other socket descriptors have something ready to read.
-         * The reason we iterate over the rset descriptors at the top level and
-         * search through the two lists of clients each time is that it is
-         * possible that a client will be removed in the middle of one of the
-         * operations. This is also why we call break after handling the input.
-         * If a client has been removed the loop variables may not longer be 
-         * valid.
-         */
-        int cur_fd, dp, cmp, exist, num_read, correct, invalid;
-        char win_game_msg[MAX_MSG] = {'\0'};
-        char game_continue_msg[MAX_MSG] = {'\0'};
-        char guess[MAX_BUF] = {'\0'};
-        char username[MAX_NAME] = {'\0'};
-        for(cur_fd = 0; cur_fd <= maxfd; cur_fd++) {
-            if(FD_ISSET(cur_fd, &rset)) {
-                // Check if this socket descriptor is an active player
-                for(p = game.head; p != NULL; p = p->next) {
-                    if (cur_fd == p->fd) {
-                        // TODO - handle input from an active client
-
-                        // Read a valid guess from the right person (The first posible line of removing this player entirely)
-                        invalid = read_guess(cur_fd, p, &game, p->name);
-                        // Check if the player still exists
-                        exist = check_exist(&(game.head), cur_fd);
-                        if (exist && invalid == 0) { // Not disconnected nor invalid
-                            // Copy to guess to make code more readable
-                            strcpy(guess, p->inbuf);
-                            // Clear it for further reading
-                            clear_inbuf(p, MAX_BUF);
-                            // Print to server
-                            num_read = strlen(guess) + 2;
-                            printf("[%d] Read %d bytes\n", cur_fd, num_read);
-                            printf("[%d] Found newline %s\n",cur_fd, guess);
-                            // Update letter guessed
-                            game.letters_guessed[guess[0] - 97] = 1;
-                            // Update the word
-                            correct = update_guessed(&game, guess);
-                            // Compare updated guess with the real word
-                            cmp = strcmp(game.guess, game.word);
-                            if (cmp == 0) { // The word is guessed out
-                                // Construct message for game over
-                                strcat(win_game_msg, "The word was ");
-                                strcat(win_game_msg, game.word);
-                                strcat(win_game_msg, "\r\n");
-                                // Broadcast
-                                broadcast(&game, win_game_msg, -1);
-                                // Announce winner
-                                announce_winner(&game, p);
-                                // Print to server
-                                printf("Game over. %s won!\nNew game\n", p->name);
-                                // Restart game
-                                init_game(&game, argv[1]);
-                                // Announce turn
-                                announce_turn(&game);
-                                // Print to server
-                                printf("It's %s's turn.\n", (game.current_player)->name);
-                            } else { // Word is not guessed out
-                                // If the guess was wrong
-                                if (correct == 0) {
-                                    // Tell player not correct
-                                    dp = dprintf(cur_fd, "%c is not in the word\r\n", guess[0]);
-                                    if (dp < 0) { // Disconnection
-                                        remove_player(&game, &(game.head), cur_fd, "main guess wrong");
-                                    }
-                                    // Game Logic
-                                    game.guesses_left -= 1;
-                                    advance_turn(&game);
-                                    // Print to server
-                                    printf("Letter %c is not in the word\n", guess[0]);
-                                }
-                                // Construct game message since game probably continues
-                                strcat(game_continue_msg, p->name);
-                                strcat(game_continue_msg, " guesses: ");
-                                strncat(game_continue_msg, guess, 1);
-                                strcat(game_continue_msg, "\r\n");
-                                // Broadcast to everyone
-                                broadcast(&game, game_continue_msg, -1);
-                                // Construct status message
-                                char *turn_msg;
-                                if (MAX_GUESSES > 13) { // 14 chances or above will require more space
-                                    turn_msg = malloc(2 * MAX_MSG);
-                                } else { // 13 chances or below will only require such space
-                                    turn_msg = malloc(MAX_MSG);
-                                }
-                                if (!turn_msg) {
-                                    perror("malloc");
-                                    exit(1);
-                                }
-                                turn_msg = status_message(turn_msg, &game);
-                                // Broadcast status message
-                                broadcast(&game, turn_msg, -1);
-                                announce_turn(&game);
-                                // Print to server
-                                if (!no_guess(&game)) {
-                                    printf("It's %s's turn.\n", (game.current_player)->name);
-                                }
-                                // Free
-                                free(turn_msg);
-                                // If the game must end due to no guessing chance left
-                                if (no_guess(&game)) {
-                                    printf("Evaluating for game_over\nNew game\n");
-                                    init_game(&game, argv[1]);
-                                    // Announce turn
-                                    announce_turn(&game);
-                                    // Print to server
-                                    printf("It's %s's turn.\n", (game.current_player)->name);
-                                }
-                            }
-                            // Must break here
-                            break;
-                        } else { //Either not exist or not valid
-                            break;
-                        }
-                    }
-                }
-                // Check if any new players are entering their names
-                for(p = new_players; p != NULL; p = p->next) {
-                    if(cur_fd == p->fd) {
-                        // TODO - handle input from an new client who has not entered an acceptable name.
-                        // Read a valid username
-                        invalid = read_username(p, &game, cur_fd, &new_players);
-                        // Check if the user disconnected before enterring a name
-                        exist = check_exist(&(new_players), cur_fd);
-                        if (exist && invalid == 0) { // The player didn't disconnect and entered a valid name
-                            // Copy to username to make code more readable
-                            strcpy(username, p->inbuf);
-                            // Clear it for further reading
-                            clear_inbuf(p, MAX_NAME);
-                            // Put the user into official playing game
-                            move_to_game(&new_players, cur_fd, &game, username);
-                            // Print messages to server
-                            num_read = strlen(username) + 2;
-                            printf("[%d] Read %d bytes\n", cur_fd, num_read);
-                            printf("[%d] Found newline %s\n", cur_fd, username);
-                            // Construct joining message
-                            char join_msg[MAX_MSG];
-                            strcpy(join_msg, username);
-                            strcat(join_msg, " has joined.\r\n");
-                            // Broadcast to everyone except for who joined
-                            broadcast(&game, join_msg, -1);
-                            // Printf to server
-                            printf("%s", join_msg);
-                            printf("It's %s's turn.\n", (game.current_player)->name);
-                            // Construct status message
-                            char *turn_msg;
-                            if (MAX_GUESSES > 13) {  // 14 chances or above will require more space
-                                turn_msg = malloc(2 * MAX_MSG);
-                            } else {  // 13 chances or below will only require such space
-                                turn_msg = malloc(MAX_MSG);
-                            }
-                            if (turn_msg == NULL) {
-                                perror("malloc");
-                                exit(1);
-                            }
-                            turn_msg = status_message(turn_msg, &game);
-                            // Let the user know the current game status
-                            dp = dprintf(cur_fd, "%s", turn_msg);
-                            if (dp < 0) {
-                                remove_player(&game, &(game.head), cur_fd, "main add new player");
-                            }
-                            // Free
-                            free(turn_msg);
-                            // Announce the new player who should be playing
-                            announce_turn(&game);
-                            break;
-                        } else {
-                            break;
-                        }
-                    }
-                }
+
+        // Check which other socket descriptors have something ready to read.
+        for(int cur_fd = 0; cur_fd <= maxfd; cur_fd++) {
+            if(!FD_ISSET(cur_fd, &rset) || cur_fd == listenfd) {
+                continue;
+            }
+            // Without a console, fd 0 may well be a client
+            if (cur_fd == STDIN_FILENO && admin_open) {
+                read_admin();
+                continue;
+            }
+            // Rate limit before any parsing
+            int verdict = limit_take(cur_fd, clock_ms());
+            if (verdict == LIMIT_KICK) {
+                kick_client(&game, &new_players, cur_fd);
+                continue;
+            }
+            handle_input(&game, &new_players, cur_fd, dict_name);
+            if (verdict == LIMIT_PAUSE) {
+                // Leave further input in the kernel until resume_paused
+                FD_CLR(cur_fd, &allset);
             }
         }
+
+        // One send per client for everything this iteration produced
+        flush_output(&game, &new_players);
     }
+
+    // Stopped by a signal: make sure nothing recorded is lost
+    record_close();
+    stats_close();
     return 0;
 }